@@ -0,0 +1,266 @@
+#ifndef ALGO_CHECKPOINT_H_
+#define ALGO_CHECKPOINT_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "defs.h"
+
+namespace algo {
+
+// Kinds of tables stored in checkpoint files, so that a file written by one
+// engine is never resumed or queried by another one.
+enum CheckpointKind {
+  kPrimeSumCheckpoint = 1,
+  kMultiplicitiveSum2Checkpoint = 2,
+};
+
+struct CheckpointSection {
+  // Number of elements in the section.
+  llong size;
+  // Whether the section is kept in two slots. A buffered section can be
+  // rewritten on every snapshot, and the previous snapshot stays intact until
+  // the new one is committed. An unbuffered section must only be written with
+  // values that never change afterwards.
+  bool buffered;
+};
+
+namespace {
+
+const int kMaxCheckpointSections = 8;
+const int kCheckpointVersion = 1;
+const char kCheckpointMagic[8] = {'A', 'L', 'G', 'O', 'C', 'K', 'P', 'T'};
+
+struct CheckpointHeader {
+  char magic[8];
+  int version;
+  int kind;
+  int element_size;
+  int section_count;
+  llong n;
+  // Engine-specific progress of the last commit, -1 if nothing is committed.
+  llong progress;
+  // The committed slot of buffered sections.
+  int active;
+  int finished;
+  llong sizes[kMaxCheckpointSections];
+  int buffered[kMaxCheckpointSections];
+};
+
+// Sections start at a page boundary after the header.
+const llong kCheckpointHeaderSize = 4096;
+
+}  // namespace
+
+// A memory-mapped file holding the tables of a long-running sieve, so that the
+// run can be resumed after being pre-empted, and the finished tables can be
+// reopened read-only and queried by later processes without recomputation.
+//
+// T must be trivially copyable, and the file is only meant to be read on
+// machines with the same memory layout of T.
+template <typename T>
+class SieveCheckpoint {
+ public:
+  // Opens the checkpoint at path for writing. The file is (re)created when it
+  // does not exist or holds a different kind, n or layout of sections.
+  // - interval: seconds between two snapshots, see Due().
+  static std::unique_ptr<SieveCheckpoint<T>> Create(
+      const std::string& path, int kind, llong n,
+      const std::vector<CheckpointSection>& sections, double interval);
+
+  // Opens a finished checkpoint read-only.
+  // Returns nullptr if the file is missing, unfinished, or of another kind.
+  static std::unique_ptr<SieveCheckpoint<T>> OpenReadOnly(
+      const std::string& path, int kind);
+
+  ~SieveCheckpoint();
+
+  llong GetN() const { return header()->n; }
+  llong GetSectionSize(int i) const { return header()->sizes[i]; }
+  llong GetProgress() const { return header()->progress; }
+  bool IsFinished() const { return header()->finished != 0; }
+
+  // Gets the committed content of section i.
+  const T* Read(int i) const { return section(i, header()->active); }
+  // Gets the buffer of section i to be filled before the next Commit.
+  T* Write(int i) { return section(i, 1-header()->active); }
+
+  // Flushes all written sections to the file, then atomically makes them the
+  // committed state together with the given progress.
+  void Commit(llong progress, bool finished);
+
+  // Returns true if at least "interval" seconds passed since the last commit.
+  bool Due() const {
+    return std::chrono::steady_clock::now() >= next_commit;
+  }
+
+ private:
+  SieveCheckpoint(int fd_, char* data_, llong size_, bool writable_,
+                  double interval_)
+      : fd(fd_), data(data_), size(size_), writable(writable_),
+        interval(interval_) {
+    schedule();
+  }
+
+  static llong GetFileSize(const CheckpointHeader& h);
+
+  CheckpointHeader* header() const {
+    return reinterpret_cast<CheckpointHeader*>(data);
+  }
+  T* section(int i, int slot) const;
+  void schedule() {
+    next_commit = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(interval));
+  }
+
+  static_assert(std::is_trivially_copyable<T>::value,
+                "checkpointed values must be trivially copyable");
+
+  int fd;
+  char* data;
+  llong size;
+  bool writable;
+  double interval;
+  std::chrono::steady_clock::time_point next_commit;
+};
+
+template <typename T>
+llong SieveCheckpoint<T>::GetFileSize(const CheckpointHeader& h) {
+  llong res = kCheckpointHeaderSize;
+  for (int i = 0; i < h.section_count; i++)
+    res += (h.buffered[i] ? 2 : 1) * h.sizes[i] * llong(sizeof(T));
+  return res;
+}
+
+template <typename T>
+T* SieveCheckpoint<T>::section(int i, int slot) const {
+  const CheckpointHeader* h = header();
+  assert(0 <= i && i < h->section_count);
+
+  llong offset = kCheckpointHeaderSize;
+  for (int j = 0; j < i; j++)
+    offset += (h->buffered[j] ? 2 : 1) * h->sizes[j] * llong(sizeof(T));
+  if (h->buffered[i] && slot == 1) offset += h->sizes[i] * llong(sizeof(T));
+  return reinterpret_cast<T*>(data + offset);
+}
+
+template <typename T>
+std::unique_ptr<SieveCheckpoint<T>> SieveCheckpoint<T>::Create(
+    const std::string& path, int kind, llong n,
+    const std::vector<CheckpointSection>& sections, double interval) {
+  assert(sections.size() <= kMaxCheckpointSections);
+
+  CheckpointHeader expected;
+  memset(&expected, 0, sizeof(expected));
+  memcpy(expected.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+  expected.version = kCheckpointVersion;
+  expected.kind = kind;
+  expected.element_size = sizeof(T);
+  expected.section_count = sections.size();
+  expected.n = n;
+  expected.progress = -1;
+  for (int i = 0; i < expected.section_count; i++) {
+    expected.sizes[i] = sections[i].size;
+    expected.buffered[i] = sections[i].buffered ? 1 : 0;
+  }
+  llong file_size = GetFileSize(expected);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return nullptr;
+
+  // Reuses the existing file only when its layout is exactly the same.
+  CheckpointHeader existing;
+  bool reuse = pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+      memcmp(existing.magic, expected.magic, sizeof(expected.magic)) == 0 &&
+      existing.version == expected.version && existing.kind == kind &&
+      existing.element_size == expected.element_size && existing.n == n &&
+      existing.section_count == expected.section_count &&
+      memcmp(existing.sizes, expected.sizes, sizeof(expected.sizes)) == 0 &&
+      memcmp(existing.buffered, expected.buffered,
+             sizeof(expected.buffered)) == 0;
+
+  if (!reuse) {
+    // Drops the old content first so that the new file is sparse.
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, file_size) != 0 ||
+        pwrite(fd, &expected, sizeof(expected), 0) != sizeof(expected)) {
+      close(fd);
+      return nullptr;
+    }
+  }
+
+  void* data = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<SieveCheckpoint<T>>(new SieveCheckpoint<T>(
+      fd, static_cast<char*>(data), file_size, true, interval));
+}
+
+template <typename T>
+std::unique_ptr<SieveCheckpoint<T>> SieveCheckpoint<T>::OpenReadOnly(
+    const std::string& path, int kind) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  CheckpointHeader h;
+  struct stat st;
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+      memcmp(h.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0 ||
+      h.version != kCheckpointVersion || h.kind != kind ||
+      h.element_size != sizeof(T) || !h.finished ||
+      h.section_count > kMaxCheckpointSections ||
+      fstat(fd, &st) != 0 || st.st_size != GetFileSize(h)) {
+    close(fd);
+    return nullptr;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<SieveCheckpoint<T>>(new SieveCheckpoint<T>(
+      fd, static_cast<char*>(data), st.st_size, false, 0));
+}
+
+template <typename T>
+SieveCheckpoint<T>::~SieveCheckpoint() {
+  munmap(data, size);
+  close(fd);
+}
+
+template <typename T>
+void SieveCheckpoint<T>::Commit(llong progress, bool finished) {
+  assert(writable);
+  CheckpointHeader* h = header();
+
+  // The data must reach the file before the header points to it.
+  msync(data + kCheckpointHeaderSize, size - kCheckpointHeaderSize, MS_SYNC);
+
+  bool any_buffered = false;
+  for (int i = 0; i < h->section_count; i++)
+    if (h->buffered[i]) any_buffered = true;
+  if (any_buffered) h->active = 1-h->active;
+  h->progress = progress;
+  h->finished = finished ? 1 : 0;
+  msync(data, kCheckpointHeaderSize, MS_SYNC);
+
+  schedule();
+}
+
+}  // namespace algo
+
+#endif  // ALGO_CHECKPOINT_H_
@@ -3,7 +3,10 @@
 
 #include <algorithm>
 #include <cassert>
+#include <limits>
+#include <vector>
 
+#include "defs.h"
 #include "gcd.h"
 
 namespace algo {
@@ -14,7 +17,11 @@ class CRT {
   CRT(T a, T n): a_(a), n_(n) {}
   CRT() : CRT(0, 1) {}
 
+  // Merges x = a (mod n), for n > 0. Returns false if it contradicts the
+  // congruences so far. The merged modulus must fit in T, and intermediate
+  // products are done in 128 bits.
   bool Merge(T a, T n);
+  bool Merge(const CRT<T>& other) { return Merge(other.a_, other.n_); }
   T GetSolution() const { return a_; }
   T GetModule() const { return n_; }
 
@@ -25,17 +32,134 @@ class CRT {
 
 template <typename T>
 bool CRT<T>::Merge(T a2, T n2) {
-  T g = std::__gcd(n_, n2);
+  a_ %= n_;
+  if (a_ < 0) a_ += n_;
+  a2 %= n2;
+  if (a2 < 0) a2 += n2;
+  T g = BinaryGcd(n_, n2);
   T c = a2-a_;
   if (c % g != 0) return false;
 
+  // (n_/g)*t = c/g (mod m), with the inverse of n_/g from ExtendGcd.
+  const T m = n2/g;
+  assert(i128(n_)*m <= std::numeric_limits<T>::max());
   T x1, x2;
-  assert(ExtendGcd(n_/g, n2/g, c/g, x1, x2));
-  a_ += n_*x1;
-  n_ *= n2/g;
+  bool solved = ExtendGcd(T(n_/g%m), m, T(1), x1, x2);
+  assert(solved);
+  i128 t = i128(x1)*(c/g%m)%m;
+  if (t < 0) t += m;
+  a_ = a_ + i128(n_)*t;
+  n_ *= m;
   return true;
 }
 
+// Merges all congruences x = cs[i], pairwise in a balanced tree so that the
+// operands of a merge have similar sizes. Returns false if they contradict.
+template <typename T>
+bool MergeAll(std::vector<CRT<T>> cs, CRT<T>& res) {
+  if (cs.empty()) {
+    res = CRT<T>();
+    return true;
+  }
+  while (cs.size() > 1) {
+    const int size = cs.size(), half = (size+1)/2;
+    for (int i = 0; i+half < size; i++)
+      if (!cs[i].Merge(cs[i+half])) return false;
+    cs.resize(half);
+  }
+  res = cs[0];
+  return true;
+}
+
+// Garner's algorithm for pairwise coprime moduli m_0, ..., m_{k-1}, each
+// below 2^62. For 0 <= x < M = \prod m_i given by its residues, it gets x in
+// mixed radix form
+//   x = v_0 + v_1 m_0 + v_2 m_0 m_1 + ... + v_{k-1} m_0 ... m_{k-2},
+// and then x modulo any target, without ever forming M. It takes O(k^2)
+// multiplications per x, with all inverses precomputed.
+class Garner {
+ public:
+  Garner(const std::vector<llong>& moduli);
+
+  // Gets x mod target, where x = residues[i] (mod moduli[i]).
+  llong Get(const std::vector<llong>& residues, llong target) const;
+  // Same for many x at once: residues[i][j] is x_j mod moduli[i].
+  std::vector<llong> Get(const std::vector<std::vector<llong>>& residues,
+                         llong target) const;
+
+ private:
+  static llong MulMod(llong a, llong b, llong m) { return i128(a)*b%m; }
+
+  int k;
+  std::vector<llong> m;
+  // inv[i] = (m_0 ... m_{i-1})^{-1} mod m_i
+  std::vector<llong> inv;
+  // radix[i][j] = m_0 ... m_{j-1} mod m_i, for j < i.
+  std::vector<std::vector<llong>> radix;
+};
+
+Garner::Garner(const std::vector<llong>& moduli)
+    : k(moduli.size()), m(moduli), inv(k), radix(k) {
+  for (int i = 0; i < k; i++) {
+    assert(m[i] > 0);
+    radix[i].resize(i);
+    llong prod = 1%m[i];
+    for (int j = 0; j < i; j++) {
+      radix[i][j] = prod;
+      prod = MulMod(prod, m[j], m[i]);
+    }
+    llong x1, x2;
+    bool coprime = ExtendGcd(prod, m[i], 1LL, x1, x2);
+    assert(coprime);
+    inv[i] = x1;
+  }
+}
+
+llong Garner::Get(const std::vector<llong>& residues, llong target) const {
+  std::vector<std::vector<llong>> single(k);
+  for (int i = 0; i < k; i++) single[i].assign(1, residues[i]);
+  return Get(single, target)[0];
+}
+
+std::vector<llong> Garner::Get(
+    const std::vector<std::vector<llong>>& residues, llong target) const {
+  assert(int(residues.size()) == k && target > 0);
+  const int count = k == 0 ? 0 : residues[0].size();
+
+  // v[i][j] is the i-th mixed radix digit of x_j. Digit i only needs the
+  // earlier ones modulo m_i.
+  std::vector<std::vector<llong>> v(k, std::vector<llong>(count));
+  for (int i = 0; i < k; i++) {
+    const llong mi = m[i];
+    llong* vi = &v[i][0];
+    for (int j = 0; j < count; j++) {
+      llong r = residues[i][j]%mi;
+      vi[j] = r < 0 ? r+mi : r;
+    }
+    for (int s = 0; s < i; s++) {
+      const llong w = radix[i][s];
+      const llong* vs = &v[s][0];
+      for (int j = 0; j < count; j++) {
+        llong d = vi[j] - MulMod(vs[j], w, mi);
+        vi[j] = d < 0 ? d+mi : d;
+      }
+    }
+    for (int j = 0; j < count; j++) vi[j] = MulMod(vi[j], inv[i], mi);
+  }
+
+  std::vector<llong> res(count, 0);
+  llong prod = 1%target;
+  for (int i = 0; i < k; i++) {
+    for (int j = 0; j < count; j++) {
+      // res[j] + t, without overflow for targets up to 2^63.
+      const llong t = MulMod(v[i][j]%target, prod, target);
+      res[j] = res[j] >= target-t ? res[j]-(target-t) : res[j]+t;
+    }
+    prod = MulMod(prod, m[i]%target, target);
+  }
+  return res;
+}
+
 }  // namespace algo
 
 #endif  // ALGO_CRT_H_
@@ -9,6 +9,7 @@ namespace algo {
 typedef long long llong;
 typedef unsigned long long ullong;
 typedef long double ldouble;
+typedef __int128 i128;
 typedef std::pair<int, int> PII;
 
 #define PB push_back
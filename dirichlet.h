@@ -0,0 +1,245 @@
+#ifndef ALGO_DIRICHLET_H_
+#define ALGO_DIRICHLET_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "defs.h"
+#include "division_enumerator.h"
+#include "parallel.h"
+
+namespace algo {
+
+template <typename T> class DirichletSeries;
+
+// Gets the Dirichlet convolution h = a*b, i.e. h(n) = \sum_{xy=n} a(x)b(y).
+template <typename T>
+DirichletSeries<T> DirichletMultiply(const DirichletSeries<T>& a,
+                                     const DirichletSeries<T>& b,
+                                     int threads = 1);
+
+// Gets f where f*g = h. g(1) must be invertible.
+template <typename T>
+DirichletSeries<T> DirichletDivide(const DirichletSeries<T>& h,
+                                   const DirichletSeries<T>& g,
+                                   int threads = 1);
+
+// Prefix sums F(v) = \sum_{i=1}^v f(i) of an arithmetic function f, at every
+// index v which is either <= B, or floor(N/k) for some k.
+//
+// The indices up to B are stored densely, so the values f(i) for i <= B are
+// known as well. That is what makes the operations below run in O(N^{2/3})
+// with the default B = N^{2/3}: the part up to B is sieved, and only the
+// O(N^{1/3}) large indices are calculated with the hyperbola method.
+template <typename T>
+class DirichletSeries {
+ public:
+  // b is clamped into [sqrt(n), n]. All series used together in one
+  // operation must have the same n and b.
+  DirichletSeries(llong n) : DirichletSeries(n, llong(pow(n, 2.0/3))) {}
+  DirichletSeries(llong n, llong b);
+
+  // Builds the series from its prefix sum function, which is called at
+  // every index of the series.
+  static DirichletSeries<T> FromPrefixSum(llong n, llong b,
+                                          NtFunctionT<T> prefix_sum);
+
+  // Builds the series from the values of f, which are called for all
+  // i <= B, and its prefix sum function, which is only called at the large
+  // indices.
+  static DirichletSeries<T> FromFunction(llong n, llong b, NtFunctionT<T> f,
+                                         NtFunctionT<T> prefix_sum);
+
+  // The identity of Dirichlet convolution: e(1) = 1, and e(i) = 0 otherwise.
+  static DirichletSeries<T> Identity(llong n, llong b);
+
+  llong GetN() const { return N; }
+  llong GetB() const { return B; }
+
+  // Gets F(v). v must be <= B, or floor(N/k) for some k.
+  T GetPrefixSum(llong v) const { return v <= B ? small[v] : large[N/v]; }
+  // Gets f(i) for 1 <= i <= B.
+  T Get(llong i) const { return small[i] - small[i-1]; }
+
+  // Sets F(v) for v = floor(N/k) > B.
+  void SetPrefixSum(llong v, const T& value) { large[N/v] = value; }
+
+ private:
+  template <typename V> friend DirichletSeries<V> DirichletMultiply(
+      const DirichletSeries<V>& a, const DirichletSeries<V>& b, int threads);
+  template <typename V> friend DirichletSeries<V> DirichletDivide(
+      const DirichletSeries<V>& h, const DirichletSeries<V>& g, int threads);
+
+  // Number of large indices, i.e., floor(N/k) > B for all 1 <= k <= K.
+  llong GetK() const { return N/(B+1); }
+
+  llong N;
+  llong B;
+
+  // small[v] = F(v) for 0 <= v <= B.
+  std::vector<T> small;
+  // large[k] = F(N/k) for 1 <= k <= K.
+  std::vector<T> large;
+};
+
+template <typename T>
+DirichletSeries<T>::DirichletSeries(llong n, llong b) : N(n) {
+  llong sq = llong(sqrt(n));
+  while (sq*sq > n) sq--;
+  while ((sq+1)*(sq+1) <= n) sq++;
+  B = std::max(std::min(b, n), sq);
+
+  small = std::vector<T>(B+1, T(0));
+  large = std::vector<T>(GetK()+1, T(0));
+}
+
+template <typename T>
+DirichletSeries<T> DirichletSeries<T>::FromPrefixSum(
+    llong n, llong b, NtFunctionT<T> prefix_sum) {
+  DirichletSeries<T> res(n, b);
+  for (llong v = 1; v <= res.B; v++) res.small[v] = prefix_sum(v);
+  for (llong k = 1; k <= res.GetK(); k++) res.large[k] = prefix_sum(n/k);
+  return res;
+}
+
+template <typename T>
+DirichletSeries<T> DirichletSeries<T>::FromFunction(
+    llong n, llong b, NtFunctionT<T> f, NtFunctionT<T> prefix_sum) {
+  DirichletSeries<T> res(n, b);
+  for (llong v = 1; v <= res.B; v++) res.small[v] = res.small[v-1] + f(v);
+  for (llong k = 1; k <= res.GetK(); k++) res.large[k] = prefix_sum(n/k);
+  return res;
+}
+
+template <typename T>
+DirichletSeries<T> DirichletSeries<T>::Identity(llong n, llong b) {
+  return FromPrefixSum(n, b, [](llong v) { return v >= 1 ? T(1) : T(0); });
+}
+
+template <typename T>
+DirichletSeries<T> DirichletMultiply(const DirichletSeries<T>& a,
+                                     const DirichletSeries<T>& b,
+                                     int threads) {
+  assert(a.N == b.N && a.B == b.B);
+  if (threads <= 0) threads = DefaultThreadCount();
+  DirichletSeries<T> res(a.N, a.B);
+  const llong B = a.B;
+
+  std::vector<T> fa(B+1), fb(B+1);
+  for (llong i = 1; i <= B; i++) {
+    fa[i] = a.Get(i);
+    fb[i] = b.Get(i);
+  }
+
+  // Sieves h(i) for i <= B. Every chunk [lo, hi) of the output is filled by
+  // one worker, so no two workers write to the same value. Factors x up to
+  // the chunk length are walked by their multiples. Larger ones have at most
+  // one multiple in the chunk, so they are walked by the cofactor y instead,
+  // and a chunk costs no more than its products plus hi/len.
+  llong chunks = threads == 1 ? 1 : 8*threads;
+  llong chunk = B/chunks+1;
+  ParallelFor(0, chunks, threads,
+      [&res, &fa, &fb, B, chunk](llong c, int) {
+    llong lo = std::max(1LL, c*chunk), hi = std::min(B+1, (c+1)*chunk);
+    if (lo >= hi) return;
+    llong small_x = std::min(hi, hi-lo+1);
+    for (llong x = 1; x < small_x; x++) {
+      if (fa[x] == 0) continue;
+      for (llong y = std::max(1LL, (lo+x-1)/x); x*y < hi; y++)
+        res.small[x*y] += fa[x] * fb[y];
+    }
+    for (llong y = 1; y*small_x < hi; y++) {
+      if (fb[y] == 0) continue;
+      for (llong x = std::max(small_x, (lo+y-1)/y); x*y < hi; x++)
+        res.small[x*y] += fa[x] * fb[y];
+    }
+  });
+  for (llong i = 1; i <= B; i++) res.small[i] += res.small[i-1];
+
+  // H(v) = \sum_{x <= v} a(x) B(v/x), grouped by the value of v/x.
+  ParallelFor(1, res.GetK()+1, threads, [&a, &b, &res](llong k, int) {
+    DivisionBlockIterator it(res.N/k);
+    llong q[kDivisionBlockBatch], begin[kDivisionBlockBatch],
+        end[kDivisionBlockBatch];
+    T sum = T(0);
+    for (int c; (c = it.Next(q, begin, end, kDivisionBlockBatch)) > 0; ) {
+      for (int i = 0; i < c; i++)
+        sum += (a.GetPrefixSum(end[i]) - a.GetPrefixSum(begin[i])) *
+            b.GetPrefixSum(q[i]);
+    }
+    res.large[k] = sum;
+  });
+
+  return res;
+}
+
+template <typename T>
+DirichletSeries<T> DirichletDivide(const DirichletSeries<T>& h,
+                                   const DirichletSeries<T>& g,
+                                   int threads) {
+  assert(h.N == g.N && h.B == g.B);
+  if (threads <= 0) threads = DefaultThreadCount();
+  DirichletSeries<T> res(h.N, h.B);
+  const llong B = h.B;
+  const T g1_inv = T(1) / g.Get(1);
+
+  // f(x) = (h(x) - \sum_{yz=x, z>1} f(y)g(z)) / g(1), solved in increasing x.
+  std::vector<T> acc(B+1), fg(B+1);
+  for (llong i = 1; i <= B; i++) {
+    acc[i] = h.Get(i);
+    fg[i] = g.Get(i);
+  }
+  for (llong x = 1; x <= B; x++) {
+    T fx = acc[x] * g1_inv;
+    res.small[x] = res.small[x-1] + fx;
+    if (fx == 0) continue;
+    for (llong y = 2; x*y <= B; y++) acc[x*y] -= fx * fg[y];
+  }
+
+  // g(1)F(v) = H(v) - \sum_{y > 1} g(y) F(v/y). F(v) is still 0 while
+  // enumerating, and F(v/y) at index k*y is done before index k, so all
+  // indices in (hi/2, hi] can be calculated together.
+  for (llong hi = res.GetK(); hi >= 1; ) {
+    llong lo = threads == 1 ? hi-1 : hi/2;
+    ParallelFor(lo+1, hi+1, threads, [&h, &g, &res, &g1_inv](llong k, int) {
+      llong v = res.N/k;
+      DivisionBlockIterator it(v);
+      llong q[kDivisionBlockBatch], begin[kDivisionBlockBatch],
+          end[kDivisionBlockBatch];
+      T sum = h.GetPrefixSum(v);
+      for (int c; (c = it.Next(q, begin, end, kDivisionBlockBatch)) > 0; ) {
+        for (int i = 0; i < c; i++)
+          sum -= (g.GetPrefixSum(end[i]) - g.GetPrefixSum(begin[i])) *
+              res.GetPrefixSum(q[i]);
+      }
+      res.large[k] = sum * g1_inv;
+    });
+    hi = lo;
+  }
+
+  return res;
+}
+
+// Gets a^e = a*a*...*a under Dirichlet convolution.
+template <typename T>
+DirichletSeries<T> DirichletPow(const DirichletSeries<T>& a, llong e,
+                                int threads = 1) {
+  if (e == 0) return DirichletSeries<T>::Identity(a.GetN(), a.GetB());
+
+  DirichletSeries<T> res = a, base = a;
+  bool empty = true;
+  for (; e > 0; e >>= 1) {
+    if (e&1) {
+      res = empty ? base : DirichletMultiply(res, base, threads);
+      empty = false;
+    }
+    if (e > 1) base = DirichletMultiply(base, base, threads);
+  }
+  return res;
+}
+
+}  // namespace algo
+
+#endif  // ALGO_DIRICHLET_H_
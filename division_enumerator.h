@@ -1,7 +1,9 @@
 #ifndef ALGO_DIVISION_ENUMERATOR_H_
 #define ALGO_DIVISION_ENUMERATOR_H_
 
+#include <algorithm>
 #include <functional>
+#include <vector>
 
 #include "defs.h"
 
@@ -33,6 +35,85 @@ void DivisionEnumerator::Do(llong n, std::function<void(llong, llong, llong)> em
   }
 }
 
+// A batch size for the iterators below which keeps the buffers on the stack.
+const int kDivisionBlockBatch = 256;
+
+// Same ranges as DivisionEnumerator, but in increasing order of divisors and
+// written into caller-provided arrays in batches, so that no call is made per
+// range and the loops consuming them can be vectorised.
+//
+//   DivisionBlockIterator it(n);
+//   llong q[kDivisionBlockBatch], begin[...], end[...];
+//   for (int c; (c = it.Next(q, begin, end, kDivisionBlockBatch)) > 0; )
+//     for (int i = 0; i < c; i++) ...
+class DivisionBlockIterator {
+ public:
+  DivisionBlockIterator(llong n_) : n(n_), x(0) {}
+
+  // Writes at most capacity ranges, where n/x = quotient[i] for all x in
+  // (begin[i], end[i]]. Returns the number written, 0 after reaching n.
+  int Next(llong* quotient, llong* begin, llong* end, int capacity);
+
+ private:
+  llong n;
+  // All divisors <= x are written.
+  llong x;
+};
+
+int DivisionBlockIterator::Next(llong* quotient, llong* begin, llong* end,
+                                int capacity) {
+  int count = 0;
+  for (; count < capacity && x < n; count++) {
+    llong q = n/(x+1);
+    quotient[count] = q;
+    begin[count] = x;
+    end[count] = x = n/q;
+  }
+  return count;
+}
+
+// Enumerates several numerators together: the divisors in [1, max(ns)] are
+// split into the maximal ranges where all of ns[j]/x are constant. A
+// numerator smaller than x has quotient 0, which is constant until the end.
+//
+// A sum like \sum_x f(x) g(n/x) h(m/x) takes one pass over these ranges
+// instead of two nested enumerations.
+class JointDivisionIterator {
+ public:
+  JointDivisionIterator(const std::vector<llong>& ns_)
+      : ns(ns_), limit(0), x(0) {
+    for (llong n : ns) limit = std::max(limit, n);
+  }
+
+  // Writes at most capacity ranges, where ns[j]/x = quotients[j][i] for all x
+  // in (begin[i], end[i]]. quotients must hold ns.size() arrays.
+  // Returns the number written, 0 after reaching max(ns).
+  int Next(llong* const* quotients, llong* begin, llong* end, int capacity);
+
+ private:
+  std::vector<llong> ns;
+  llong limit;
+  // All divisors <= x are written.
+  llong x;
+};
+
+int JointDivisionIterator::Next(llong* const* quotients, llong* begin,
+                                llong* end, int capacity) {
+  const int m = ns.size();
+  int count = 0;
+  for (; count < capacity && x < limit; count++) {
+    llong next = limit;
+    for (int j = 0; j < m; j++) {
+      llong q = ns[j]/(x+1);
+      quotients[j][count] = q;
+      if (q > 0) next = std::min(next, ns[j]/q);
+    }
+    begin[count] = x;
+    end[count] = x = next;
+  }
+  return count;
+}
+
 }  // namespace algo
 
 #endif  // ALGO_DIVISION_ENUMERATOR_H_
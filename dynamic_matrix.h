@@ -0,0 +1,253 @@
+#ifndef ALGO_DYNAMIC_MATRIX_H_
+#define ALGO_DYNAMIC_MATRIX_H_
+
+#include <algorithm>
+#include <cassert>
+#include <type_traits>
+#include <vector>
+
+#include "defs.h"
+#include "mod_num.h"
+#include "parallel.h"
+
+namespace algo {
+
+// A matrix whose size is only known at runtime. Entries are stored row by row
+// in one heap block, so large matrices neither overflow the stack nor get
+// copied entry by entry.
+template <typename T>
+class DynamicMatrix {
+ public:
+  DynamicMatrix() : rows(0), cols(0) {}
+  DynamicMatrix(int n) : DynamicMatrix(n, n) {}
+  DynamicMatrix(int rows_, int cols_)
+      : rows(rows_), cols(cols_), a(llong(rows_)*cols_, T(0)) {}
+
+  static DynamicMatrix<T> Identity(int n) {
+    DynamicMatrix<T> res(n);
+    for (int i = 0; i < n; i++) res[i][i] = T(1);
+    return res;
+  }
+
+  int GetRows() const { return rows; }
+  int GetCols() const { return cols; }
+
+  T* operator[](int r) { return &a[llong(r)*cols]; }
+  const T* operator[](int r) const { return &a[llong(r)*cols]; }
+
+  DynamicMatrix<T>& operator+=(const DynamicMatrix<T>& m);
+  DynamicMatrix<T>& operator*=(const DynamicMatrix<T>& m) {
+    return *this = *this * m;
+  }
+
+ private:
+  int rows;
+  int cols;
+  std::vector<T> a;
+};
+
+template <typename T>
+DynamicMatrix<T>& DynamicMatrix<T>::operator+=(const DynamicMatrix<T>& m) {
+  assert(rows == m.rows && cols == m.cols);
+  const llong size = a.size();
+  for (llong i = 0; i < size; i++) a[i] += m.a[i];
+  return *this;
+}
+
+template <typename T>
+DynamicMatrix<T> operator+(const DynamicMatrix<T>& m1,
+                           const DynamicMatrix<T>& m2) {
+  DynamicMatrix<T> res = m1;
+  res += m2;
+  return res;
+}
+
+namespace {
+
+// Rows of the result computed by one task.
+const int kMatrixRowBlock = 16;
+// Rows of the right operand (i.e. terms of the dot products) per block.
+const int kMatrixInnerBlock = 128;
+// Columns of the result per block.
+const int kMatrixColBlock = 512;
+
+// res = m1 * m2 for generic types, in blocks of i-k-j loops.
+template <typename T>
+void MultiplyBlocks(const DynamicMatrix<T>& m1, const DynamicMatrix<T>& m2,
+                    DynamicMatrix<T>& res, int threads, std::false_type) {
+  const int n = m1.GetRows(), l = m1.GetCols(), m = m2.GetCols();
+  ParallelFor(0, (n+kMatrixRowBlock-1)/kMatrixRowBlock, threads,
+      [&m1, &m2, &res, n, l, m](llong block, int) {
+    int ib = block*kMatrixRowBlock, ie = std::min(n, ib+kMatrixRowBlock);
+    for (int jb = 0; jb < m; jb += kMatrixColBlock) {
+      int je = std::min(m, jb+kMatrixColBlock);
+      for (int kb = 0; kb < l; kb += kMatrixInnerBlock) {
+        int ke = std::min(l, kb+kMatrixInnerBlock);
+        for (int i = ib; i < ie; i++) {
+          T* r = res[i];
+          for (int k = kb; k < ke; k++) {
+            const T x = m1[i][k];
+            const T* b = m2[k];
+            for (int j = jb; j < je; j++) r[j] += x * b[j];
+          }
+        }
+      }
+    }
+  });
+}
+
+// res = m1 * m2 for modular types. The products of residues are accumulated
+// in 64 bits, and reduced only once per dot product.
+//
+// An accumulator is kept below fold_limit, the largest multiple of P^2 not
+// above 2^63, by one conditional subtraction per block of fold_terms terms.
+// A block adds at most fold_terms*(P-1)^2 <= fold_limit, so the sum stays
+// below 2*fold_limit <= 2^64, and one subtraction brings it back below
+// fold_limit. That keeps the sums exact without any division in the inner
+// loop.
+template <typename T>
+void MultiplyBlocks(const DynamicMatrix<T>& m1, const DynamicMatrix<T>& m2,
+                    DynamicMatrix<T>& res, int threads, std::true_type) {
+  typedef ModularTraits<T> Traits;
+  const int n = m1.GetRows(), l = m1.GetCols(), m = m2.GetCols();
+  const ullong p = Traits::kModulus;
+  const ullong square = (p-1)*(p-1);
+  const ullong fold_limit = (1ULL<<63)/(p*p)*(p*p);
+  const int fold_terms = std::max<ullong>(
+      1, std::min<ullong>(kMatrixInnerBlock, fold_limit/square));
+
+  // Residues of the right operand, converted once.
+  std::vector<ullong> b(llong(l)*m);
+  for (int k = 0; k < l; k++)
+    for (int j = 0; j < m; j++) b[llong(k)*m+j] = Traits::ToResidue(m2[k][j]);
+
+  ParallelFor(0, (n+kMatrixRowBlock-1)/kMatrixRowBlock, threads,
+      [&m1, &b, &res, n, l, m, fold_limit, fold_terms](llong block, int) {
+    int ib = block*kMatrixRowBlock, ie = std::min(n, ib+kMatrixRowBlock);
+    std::vector<ullong> acc(llong(ie-ib)*m, 0);
+    std::vector<ullong> x(fold_terms);
+    for (int kb = 0; kb < l; kb += fold_terms) {
+      int ke = std::min(l, kb+fold_terms);
+      for (int i = ib; i < ie; i++) {
+        ullong* r = &acc[llong(i-ib)*m];
+        for (int k = kb; k < ke; k++) x[k-kb] = Traits::ToResidue(m1[i][k]);
+        for (int jb = 0; jb < m; jb += kMatrixColBlock) {
+          int je = std::min(m, jb+kMatrixColBlock);
+          for (int k = kb; k < ke; k++) {
+            const ullong xk = x[k-kb];
+            const ullong* bk = &b[llong(k)*m];
+            for (int j = jb; j < je; j++) r[j] += xk * bk[j];
+          }
+          for (int j = jb; j < je; j++)
+            r[j] -= r[j] >= fold_limit ? fold_limit : 0;
+        }
+      }
+    }
+    const ullong* r = &acc[0];
+    for (int i = ib; i < ie; i++)
+      for (int j = 0; j < m; j++, r++)
+        res[i][j] = Traits::FromResidue(*r % Traits::kModulus);
+  });
+}
+
+}  // namespace
+
+// Returns m1 * m2, on given number of threads (all cores if threads <= 0).
+template <typename T>
+DynamicMatrix<T> Multiply(const DynamicMatrix<T>& m1,
+                          const DynamicMatrix<T>& m2, int threads = 1) {
+  assert(m1.GetCols() == m2.GetRows());
+  DynamicMatrix<T> res(m1.GetRows(), m2.GetCols());
+  MultiplyBlocks(m1, m2, res, threads,
+                 std::integral_constant<bool, ModularTraits<T>::kModular>());
+  return res;
+}
+
+template <typename T>
+DynamicMatrix<T> operator*(const DynamicMatrix<T>& m1,
+                           const DynamicMatrix<T>& m2) {
+  return Multiply(m1, m2);
+}
+
+// Returns m^p
+template <typename T>
+DynamicMatrix<T> pow(const DynamicMatrix<T>& m, llong p, int threads = 1) {
+  DynamicMatrix<T> res = DynamicMatrix<T>::Identity(m.GetRows());
+  DynamicMatrix<T> base = m;
+  for (bool first = true; p > 0; p >>= 1) {
+    if (p&1) {
+      res = first ? base : Multiply(res, base, threads);
+      first = false;
+    }
+    if (p > 1) base = Multiply(base, base, threads);
+  }
+  return res;
+}
+
+// Return m^0 + m^1 + ... + m^p
+//
+// Walks the bits of p+1 from the highest one, carrying P = m^k together with
+// S = m^0 + ... + m^{k-1}. Doubling k takes S += P*S and P = P*P, and adding
+// one takes S += P and P = P*m, so it needs at most 3*log(p) products.
+template <typename T>
+DynamicMatrix<T> powSum(const DynamicMatrix<T>& m, llong p, int threads = 1) {
+  const int n = m.GetRows();
+  llong k = p+1;
+  int len = 0;
+  for (llong t = k; t != 1; t /= 2) len++;
+
+  // k = 1
+  DynamicMatrix<T> power = m, sum = DynamicMatrix<T>::Identity(n);
+  for (int i = len-1; i >= 0; i--) {
+    sum += Multiply(power, sum, threads);
+    if (i > 0 || (k&1)) power = Multiply(power, power, threads);
+    if (k&(1LL<<i)) {
+      sum += power;
+      if (i > 0) power = Multiply(power, m, threads);
+    }
+  }
+  return sum;
+}
+
+// Returns m*v
+template <typename T>
+std::vector<T> operator*(const DynamicMatrix<T>& m, const std::vector<T>& v) {
+  assert(m.GetCols() == int(v.size()));
+  std::vector<T> res(m.GetRows(), T(0));
+  for (int i = 0; i < m.GetRows(); i++) {
+    const T* r = m[i];
+    for (int j = 0; j < m.GetCols(); j++) res[i] += r[j] * v[j];
+  }
+  return res;
+}
+
+// Return (m^0 + m^1 + ... + m^p) * v
+//
+// Same as the one for Matrix in matrix.h: only the log(p) squarings are
+// matrix products, the rest are matrix-vector products.
+template <typename T>
+std::vector<T> powSum(const DynamicMatrix<T>& m, llong p,
+                      const std::vector<T>& v, int threads = 1) {
+  const int n = m.GetRows();
+  std::vector<T> res(n, T(0)), u = v;
+  DynamicMatrix<T> square = m;
+  bool empty = true;
+  for (llong k = p+1; k > 0; k >>= 1) {
+    if (k&1) {
+      std::vector<T> next = empty ? res : square*res;
+      for (int i = 0; i < n; i++) next[i] += u[i];
+      res = next;
+      empty = false;
+    }
+    if (k > 1) {
+      std::vector<T> su = square*u;
+      for (int i = 0; i < n; i++) u[i] += su[i];
+      square = Multiply(square, square, threads);
+    }
+  }
+  return res;
+}
+
+}  // namespace algo
+
+#endif  // ALGO_DYNAMIC_MATRIX_H_
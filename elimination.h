@@ -0,0 +1,209 @@
+#ifndef ALGO_ELIMINATION_H_
+#define ALGO_ELIMINATION_H_
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "defs.h"
+#include "dynamic_matrix.h"
+
+namespace algo {
+
+// Gaussian elimination over a field T, e.g. ModNum<P> with a prime P.
+//
+// The elimination is blocked: pivots are found in panels of
+// kEliminationBlock columns, eliminating eagerly only inside the panel, and
+// the rest of the matrix is updated once per panel by a single product
+// (rows below) -= L * U. That product is done by Multiply in dynamic_matrix.h,
+// so it is cache-blocked, parallel over rows, and for modular types reduced
+// once per dot product. The back substitution is blocked the same way.
+
+namespace {
+
+const int kEliminationBlock = 64;
+
+// For all rows i in [r0, r1) and columns j in [c0, cols):
+//   a[i][j] -= \sum_s a[i][coef_cols[s]] * a[s0+s][j]
+template <typename T>
+void SubtractProduct(DynamicMatrix<T>& a, int r0, int r1,
+                     const std::vector<int>& coef_cols, int s0, int c0,
+                     int threads) {
+  const int t = coef_cols.size(), m = a.GetCols();
+  if (r0 >= r1 || t == 0 || c0 >= m) return;
+
+  DynamicMatrix<T> l(r1-r0, t), u(t, m-c0);
+  for (int i = r0; i < r1; i++)
+    for (int s = 0; s < t; s++) l[i-r0][s] = a[i][coef_cols[s]];
+  for (int s = 0; s < t; s++)
+    std::copy(a[s0+s]+c0, a[s0+s]+m, u[s]);
+
+  DynamicMatrix<T> p = Multiply(l, u, threads);
+  for (int i = r0; i < r1; i++) {
+    T* row = a[i];
+    const T* d = p[i-r0];
+    for (int j = c0; j < m; j++) row[j] -= d[j-c0];
+  }
+}
+
+}  // namespace
+
+// Reduces a to row echelon form in place, only with row operations, choosing
+// pivots in the first cols columns. The other columns (e.g. right hand sides)
+// are transformed along.
+//
+// After return, row s < pivots.size() has its pivot in column pivots[s], and
+// all entries below the pivots are 0. If reduced is true, every pivot is 1
+// and the entries above pivots are 0 as well.
+//
+// Returns the product of the pivots before normalizing, negated on odd
+// number of row swaps. It is the determinant when a is square and cols = n.
+template <typename T>
+T RowEchelon(DynamicMatrix<T>& a, int cols, bool reduced,
+             std::vector<int>& pivots, int threads = 1) {
+  const int n = a.GetRows(), m = a.GetCols();
+  pivots.clear();
+  T det = T(1);
+
+  for (int c = 0; c < cols && int(pivots.size()) < n; ) {
+    const int r0 = pivots.size(), c1 = std::min(cols, c+kEliminationBlock);
+
+    // Factors the panel [c, c1). Multipliers are kept in place of the
+    // eliminated entries until the rest of the rows is updated.
+    std::vector<int> panel;
+    for (int col = c; col < c1 && r0+int(panel.size()) < n; col++) {
+      const int r = r0+panel.size();
+      int p = r;
+      while (p < n && a[p][col] == T(0)) p++;
+      if (p == n) continue;
+      if (p != r) {
+        std::swap_ranges(a[p], a[p]+m, a[r]);
+        det = -det;
+      }
+      det *= a[r][col];
+
+      const T inv = T(1)/a[r][col];
+      for (int i = r+1; i < n; i++) {
+        if (a[i][col] == T(0)) continue;
+        const T f = a[i][col]*inv;
+        a[i][col] = f;
+        for (int j = col+1; j < c1; j++) a[i][j] -= f*a[r][j];
+      }
+      panel.push_back(col);
+    }
+
+    // Applies the panel to the pivot rows, i.e. U12 = L11^{-1} A12 ...
+    const int t = panel.size();
+    for (int s = 0; s < t; s++) {
+      T* row = a[r0+s];
+      for (int s2 = 0; s2 < s; s2++) {
+        const T f = row[panel[s2]];
+        row[panel[s2]] = T(0);
+        if (f == T(0)) continue;
+        const T* src = a[r0+s2];
+        for (int j = c1; j < m; j++) row[j] -= f*src[j];
+      }
+    }
+    // ... and to the rows below, i.e. A22 -= L21 U12.
+    SubtractProduct(a, r0+t, n, panel, r0, c1, threads);
+    for (int i = r0+t; i < n; i++)
+      for (int col : panel) a[i][col] = T(0);
+
+    pivots.insert(pivots.end(), panel.begin(), panel.end());
+    c = c1;
+  }
+
+  if (!reduced) return det;
+
+  const int rank = pivots.size();
+  for (int s = 0; s < rank; s++) {
+    T* row = a[s];
+    const T inv = T(1)/row[pivots[s]];
+    for (int j = pivots[s]; j < m; j++) row[j] *= inv;
+  }
+
+  // Eliminates above the pivots, one block of pivot rows at a time from the
+  // bottom. Inside a block the rows are reduced against each other first.
+  for (int b1 = rank; b1 > 0; ) {
+    const int b0 = std::max(0, b1-kEliminationBlock);
+    for (int s = b1-1; s > b0; s--) {
+      const T* src = a[s];
+      for (int i = b0; i < s; i++) {
+        const T f = a[i][pivots[s]];
+        if (f == T(0)) continue;
+        for (int j = pivots[s]; j < m; j++) a[i][j] -= f*src[j];
+      }
+    }
+    std::vector<int> block(pivots.begin()+b0, pivots.begin()+b1);
+    SubtractProduct(a, 0, b0, block, b0, pivots[b0], threads);
+    b1 = b0;
+  }
+  return det;
+}
+
+template <typename T>
+T Determinant(DynamicMatrix<T> a, int threads = 1) {
+  assert(a.GetRows() == a.GetCols());
+  std::vector<int> pivots;
+  T det = RowEchelon(a, a.GetCols(), false, pivots, threads);
+  const int rank = pivots.size();
+  return rank == a.GetRows() ? det : T(0);
+}
+
+template <typename T>
+int Rank(DynamicMatrix<T> a, int threads = 1) {
+  std::vector<int> pivots;
+  RowEchelon(a, a.GetCols(), false, pivots, threads);
+  return pivots.size();
+}
+
+// Gets the inverse of a square matrix a into res.
+// Returns false if a is singular.
+template <typename T>
+bool Inverse(const DynamicMatrix<T>& a, DynamicMatrix<T>& res,
+             int threads = 1) {
+  const int n = a.GetRows();
+  assert(a.GetCols() == n);
+
+  DynamicMatrix<T> aug(n, 2*n);
+  for (int i = 0; i < n; i++) {
+    std::copy(a[i], a[i]+n, aug[i]);
+    aug[i][n+i] = T(1);
+  }
+  std::vector<int> pivots;
+  RowEchelon(aug, n, true, pivots, threads);
+  const int rank = pivots.size();
+  if (rank < n) return false;
+
+  res = DynamicMatrix<T>(n);
+  for (int i = 0; i < n; i++) std::copy(aug[i]+n, aug[i]+2*n, res[i]);
+  return true;
+}
+
+// Finds a solution x of a*x = b. The free variables are set to 0.
+// Returns false if there is no solution.
+template <typename T>
+bool Solve(const DynamicMatrix<T>& a, const std::vector<T>& b,
+           std::vector<T>& x, int threads = 1) {
+  const int n = a.GetRows(), cols = a.GetCols();
+  assert(int(b.size()) == n);
+
+  DynamicMatrix<T> aug(n, cols+1);
+  for (int i = 0; i < n; i++) {
+    std::copy(a[i], a[i]+cols, aug[i]);
+    aug[i][cols] = b[i];
+  }
+  std::vector<int> pivots;
+  RowEchelon(aug, cols, true, pivots, threads);
+  const int rank = pivots.size();
+  for (int i = rank; i < n; i++)
+    if (aug[i][cols] != T(0)) return false;
+
+  x = std::vector<T>(cols, T(0));
+  for (int s = 0; s < rank; s++) x[pivots[s]] = aug[s][cols];
+  return true;
+}
+
+}  // namespace algo
+
+#endif  // ALGO_ELIMINATION_H_
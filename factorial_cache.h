@@ -0,0 +1,148 @@
+#ifndef ALGO_FACTORIAL_CACHE_H_
+#define ALGO_FACTORIAL_CACHE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "defs.h"
+#include "mod_num.h"
+
+namespace algo {
+
+// Factorials, inverse factorials and inverses of 1, 2, ..., shared by the
+// whole process for each type T (so for each modulus with ModNum<P>). T must
+// be a field whose characteristic exceeds every index asked for.
+//
+// The tables grow on demand to at least twice their size, in chunks which
+// never move once built, so readers need no lock: a reader only looks at
+// indices below the published size, which is stored after their chunk.
+// Growing is serialized by a mutex. For ModNum<P> the published size never
+// exceeds P, as P! = 0 has no inverse.
+template <typename T>
+class FactorialCache {
+ public:
+  static FactorialCache<T>& Instance() {
+    static FactorialCache<T> instance;
+    return instance;
+  }
+
+  // Makes indices 0 ... n available.
+  void Reserve(int n) {
+    if (n >= size.load(std::memory_order_acquire)) Grow(n);
+  }
+
+  // n!
+  T Factorial(int n) { return Entry(n).fact; }
+  // 1/n!
+  T FactorialInverse(int n) { return Entry(n).fact_inv; }
+  // 1/n for n >= 1.
+  T Inverse(int n) { return Entry(n).inv; }
+
+  // n choose k, 0 if k < 0 or k > n.
+  T C(int n, int k) {
+    if (n < 0 || k < 0 || n < k) return T(0);
+    const Item& a = Entry(n);
+    return a.fact * Entry(k).fact_inv * Entry(n-k).fact_inv;
+  }
+
+ private:
+  struct Item {
+    T fact;
+    T fact_inv;
+    T inv;
+  };
+
+  // Chunk 0 holds [0, kFirstChunk), and chunk c > 0 holds
+  // [kFirstChunk*2^(c-1), kFirstChunk*2^c), so all indices are below 2^30.
+  static const int kFirstChunk = 1<<10;
+  static const int kMaxChunks = 21;
+
+  FactorialCache() : size(0) {}
+
+  static int ChunkOf(int i) {
+    return i < kFirstChunk ? 0 : 64-__builtin_clzll(i/kFirstChunk);
+  }
+  static int ChunkBegin(int c) { return c == 0 ? 0 : kFirstChunk<<(c-1); }
+
+  // One past the largest index that can be published.
+  static llong Capacity(std::true_type) {
+    return std::min<llong>(ModularTraits<T>::kModulus,
+                           ChunkBegin(kMaxChunks));
+  }
+  static llong Capacity(std::false_type) { return ChunkBegin(kMaxChunks); }
+
+  const Item& Entry(int i) {
+    assert(i >= 0);
+    if (i >= size.load(std::memory_order_acquire)) Grow(i);
+    const int c = ChunkOf(i);
+    return chunks[c][i-ChunkBegin(c)];
+  }
+
+  Item& At(int i) {
+    const int c = ChunkOf(i);
+    return chunks[c][i-ChunkBegin(c)];
+  }
+
+  // Fills fact_inv and inv of [begin, end), given fact.
+  void FillInverses(int begin, int end, std::true_type);
+  void FillInverses(int begin, int end, std::false_type);
+  void Grow(int n);
+
+  // Number of valid entries, published after the chunks holding them.
+  std::atomic<int> size;
+  std::unique_ptr<Item[]> chunks[kMaxChunks];
+  std::mutex lock;
+};
+
+// One division for the whole range, then backwards.
+template <typename T>
+void FactorialCache<T>::FillInverses(int begin, int end, std::true_type) {
+  At(end-1).fact_inv = T(1) / At(end-1).fact;
+  for (int i = end-1; i > begin; i--)
+    At(i-1).fact_inv = At(i).fact_inv * T(i);
+  for (int i = begin; i < end; i++)
+    At(i).inv = i == 0 ? T(0) : At(i).fact_inv * At(i-1).fact;
+}
+
+// Divisions per index: for floating point T the factorials at the end of a
+// chunk overflow, and their inverse would zero the whole range.
+template <typename T>
+void FactorialCache<T>::FillInverses(int begin, int end, std::false_type) {
+  for (int i = begin; i < end; i++) {
+    At(i).inv = i == 0 ? T(0) : T(1) / T(i);
+    At(i).fact_inv = i == 0 ? T(1) : At(i-1).fact_inv * At(i).inv;
+  }
+}
+
+template <typename T>
+void FactorialCache<T>::Grow(int n) {
+  std::lock_guard<std::mutex> guard(lock);
+  const int old_size = size.load(std::memory_order_relaxed);
+  if (n < old_size) return;
+
+  // Whole chunks are allocated, at least doubling the size, but only the
+  // indices below the capacity are filled and published.
+  const llong capacity =
+      Capacity(std::integral_constant<bool, ModularTraits<T>::kModular>());
+  assert(n < capacity);
+  const int last = ChunkOf(std::max(n, 2*old_size-1));
+  assert(last < kMaxChunks);
+  for (int c = ChunkOf(old_size); c <= last; c++)
+    if (!chunks[c]) chunks[c].reset(new Item[ChunkBegin(c+1)-ChunkBegin(c)]);
+  const int new_size = std::min<llong>(ChunkBegin(last+1), capacity);
+
+  for (int i = old_size; i < new_size; i++)
+    At(i).fact = i == 0 ? T(1) : At(i-1).fact * T(i);
+  FillInverses(old_size, new_size,
+               std::integral_constant<bool, ModularTraits<T>::kModular>());
+
+  size.store(new_size, std::memory_order_release);
+}
+
+}  // namespace algo
+
+#endif  // ALGO_FACTORIAL_CACHE_H_
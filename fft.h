@@ -20,53 +20,35 @@ typedef std::complex<ldouble> ftype;
 
 const ldouble PI = acosl(-1);
 
-template <typename T>
-class ArraySlice {
- public:
-  ArraySlice(std::vector<T>* pA, int psz, int pa = 1, int pb = 0)
-      : A(pA), sz(psz), a(pa), b(pb) {
-    assert(A != nullptr);
-  }
-  ArraySlice(std::vector<T>& pA, int psz) : ArraySlice(&pA, psz) {}
-  ArraySlice(std::vector<T>& pA) : ArraySlice(&pA, pA.size()) {}
-
-  // Subarray which contains even indexes of current one.
-  ArraySlice Even() { return ArraySlice(A, sz/2, 2*a, b); }
-  // Subarray which contains odd indexes of current one.
-  ArraySlice Odd() { return ArraySlice(A, sz-sz/2, 2*a, b+a); }
-  // Subarray of the first half. Must apply on even length array slices.
-  ArraySlice FirstHalf() { return ArraySlice(A, sz/2, a, b); }
-  // Subarray of the second half. Must apply on even length array slices.
-  ArraySlice SecondHalf() { return ArraySlice(A, sz/2, a, b+sz/2); }
-
-  int size() const { return sz; }
-  T& operator[](int n) { assert(a*n+b < A->size()); return (*A)[a*n+b]; }
-  const T operator[](int n) const { assert(a*n+b < A->size()); return (*A)[a*n+b]; }
-
- private:
-  std::vector<T>* A; // not owned
-  // i-th element is A[a*i+b]
-  int sz;
-  int a;
-  int b;
-};
+// Multiplies without the NaN/infinity handling of std::complex, which would
+// otherwise be a library call per butterfly.
+inline ftype FastMultiply(const ftype& a, const ftype& b)
+{
+  return ftype(a.real()*b.real() - a.imag()*b.imag(),
+               a.real()*b.imag() + a.imag()*b.real());
+}
 
-template <typename T>
-void FftInternal(ArraySlice<T> a, ArraySlice<T> c, ArraySlice<T> w)
+// In-place iterative FFT: a[k] = \sum_i a[i] * w[(i*k) % n], where n is a
+// power of 2 and w has n elements.
+void FftInPlace(std::vector<ftype>& a, const std::vector<ftype>& w)
 {
-  int n = w.size();
-  if (n == 1) {
-    c[0] = a[0];
-    return;
+  int n = a.size();
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(a[i], a[j]);
   }
 
-  int hn = n/2;
-  FftInternal(a.Even(), c.FirstHalf(), w.Even());
-  FftInternal(a.Odd(), c.SecondHalf(), w.Even());
-  for (int i = 0; i < hn; i++) {
-    T a1 = c[i], b1 = c[i+hn];
-    c[i] = a1 + w[i] * b1;
-    c[i+hn] = a1 - w[i] * b1;
+  for (int len = 2; len <= n; len <<= 1) {
+    int half = len/2, step = n/len;
+    for (int i = 0; i < n; i += len) {
+      for (int j = 0; j < half; j++) {
+        ftype u = a[i+j], v = FastMultiply(a[i+j+half], w[j*step]);
+        a[i+j] = u + v;
+        a[i+j+half] = u - v;
+      }
+    }
   }
 }
 
@@ -120,20 +102,17 @@ std::vector<llong> fft(const std::vector<int>& pa, const std::vector<int>& pb)
 
   auto root = std::vector<ftype>(n);
   for (int i = 0; i < n; i++) root[i] = std::polar(1.0L, 2*PI/n*i);
-  auto r = std::vector<ftype>(n);
-  auto rt = std::vector<ftype>(n);
 
-  FftInternal<ftype>(a, rt, root);
-  for (int i = 0; i < n; i++) r[i] = rt[i];
-  FftInternal<ftype>(b, rt, root);
-  for (int i = 0; i < n; i++) r[i] *= rt[i];
+  FftInPlace(a, root);
+  FftInPlace(b, root);
+  for (int i = 0; i < n; i++) a[i] = FastMultiply(a[i], b[i]);
 
   // Get inverse of w
   reverse(root.begin()+1, root.end());
-  FftInternal<ftype>(r, rt, root);
+  FftInPlace(a, root);
 
   std::vector<llong> res(n);
-  for (int i = 0; i < n; i++) res[i] = round(rt[i].real());
+  for (int i = 0; i < n; i++) res[i] = round(a[i].real());
   return res;
 }
 
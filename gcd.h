@@ -1,10 +1,43 @@
 #ifndef ALGO_GCD_H_
 #define ALGO_GCD_H_
 
+#include <algorithm>
+#include <vector>
+
+#include "defs.h"
+
 namespace algo {
 
+// Gets gcd(|a|, |b|) by Stein's binary algorithm: only shifts and
+// subtractions, with the shifts counted by __builtin_ctzll. The trailing
+// zeros of the next difference are counted while min/abs are computed, which
+// keeps the loop off a single dependency chain. Inputs must be below 2^63.
+template <typename T>
+T BinaryGcd(T a, T b) {
+  ullong x = a < 0 ? -ullong(a) : ullong(a);
+  ullong y = b < 0 ? -ullong(b) : ullong(b);
+  if (x == 0) return T(y);
+  if (y == 0) return T(x);
+
+  int zeros = __builtin_ctzll(x);
+  const int shift = std::min(zeros, __builtin_ctzll(y));
+  y >>= __builtin_ctzll(y);
+  while (x != 0) {
+    x >>= zeros;
+    const llong diff = llong(y-x);
+    zeros = __builtin_ctzll(diff);
+    y = std::min(x, y);
+    x = diff < 0 ? -diff : diff;
+  }
+  return T(y << shift);
+}
+
 // For given (n1, n2, c), find a solution (x1, x2) which satisifes n1*x1 + n2*x2 = c.
 // Returns true iff a solution can be found.
+//
+// For n1 >= 0 and n2 > 0, x1 is the smallest non-negative solution, so
+// 0 <= x1 < n2/gcd(n1, n2). The Bezout coefficients are found by an
+// iterative Euclid, with one division per step, and scaled by c in 128 bits.
 template <typename T>
 bool ExtendGcd(T n1, T n2, T c, T& x1, T& x2) {
   if (n2 == 0) {
@@ -12,30 +45,68 @@ bool ExtendGcd(T n1, T n2, T c, T& x1, T& x2) {
 
     x1 = c / n1;
     x2 = 0;
-  } else {
-    T y1, y2;
-    // n1*x1 + n2*x2 = c
-    // ==> n2*x2 + (n1%n2 + k*n2)*x1 = c
-    // ==> n2*(x2+k*x1) + n1%n2*x1 = c
-    // ==> x1 = y2, x2 = y1 - k*y2
-    if (!ExtendGcd(n2, n1%n2, c, y1, y2))
-      return false;
-
-    x1 = y2;
-    x2 = y1 - n1/n2*y2;
-
-    T delta = x1/n2;
-    x1 -= delta*n2;
-    x2 += delta*n1;
-    if (x1 < 0) {
-      x1 += n2;
-      x2 -= n1;
-    }
+    return true;
+  }
+
+  // Invariant: a = n1*u (mod n2) and b = n1*v (mod n2).
+  T a = n1, b = n2, u = 1, v = 0;
+  while (b != 0) {
+    T q = a / b;
+    a -= q*b;
+    u -= q*v;
+    std::swap(a, b);
+    std::swap(u, v);
   }
+  if (a < 0) {
+    a = -a;
+    u = -u;
+  }
+  if (c % a != 0) return false;
 
+  // n1*u = g (mod n2), so x1 = u*c/g modulo n2/g.
+  const T m = n2 / a;
+  const T mod = m < 0 ? -m : m;
+  i128 x = i128(u % mod) * (c / a % mod) % mod;
+  if (x < 0) x += mod;
+  x1 = T(x);
+  x2 = T((i128(c) - i128(n1)*x) / n2);
   return true;
 }
 
+namespace {
+
+// Products of this many terms share a single gcd in FirstCommonDivisor.
+const int kGcdBatch = 128;
+
+}  // namespace
+
+// Finds the first i with gcd(a[i], n) > 1, for n > 1, and returns that
+// gcd, or 1 if there is none. The index is stored into *index (-1 if none).
+//
+// As in Pollard's rho, the a[i] are multiplied modulo n in blocks of
+// kGcdBatch and only the products are checked with a gcd. A block whose
+// product is not coprime to n is checked again term by term.
+template <typename T>
+T FirstCommonDivisor(const std::vector<T>& a, T n, int* index = nullptr) {
+  if (index) *index = -1;
+  const int size = a.size();
+  for (int begin = 0; begin < size; begin += kGcdBatch) {
+    const int end = std::min(size, begin+kGcdBatch);
+    i128 prod = 1;
+    for (int i = begin; i < end; i++) prod = prod * (a[i] % n) % n;
+    if (BinaryGcd(T(prod), n) == 1) continue;
+
+    for (int i = begin; i < end; i++) {
+      T g = BinaryGcd(a[i], n);
+      if (g != 1) {
+        if (index) *index = i;
+        return g;
+      }
+    }
+  }
+  return T(1);
+}
+
 }  // namespace algo
 
 #endif  // ALGO_GCD_H_
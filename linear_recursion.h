@@ -1,52 +1,169 @@
 #ifndef ALGO_LINEAR_RECURSION_H_
 #define ALGO_LINEAR_RECURSION_H_
 
+#include <algorithm>
+#include <cassert>
+#include <memory>
 #include <vector>
 
 #include "defs.h"
+#include "mod_num.h"
 #include "modular.h"
+#include "parallel.h"
+#include "polynomial.h"
 
 namespace algo {
 
+// Berlekamp-Massey algorithm, fed one term at a time.
+//
+// All buffers are allocated up front for at most "capacity" terms, and can
+// be reused for other sequences via Reset. A correction costs one
+// multiplication per coefficient; the only division happens when the
+// recursion gets longer.
+template<typename T>
+class BerlekampMassey {
+ public:
+  BerlekampMassey(int capacity) { Reset(capacity); }
+
+  // Starts a new sequence of at most capacity terms.
+  void Reset(int capacity);
+
+  // Appends the next term. Returns the length of the minimum linear
+  // recursion of all terms so far, so that callers can give up early on
+  // sequences whose recursion gets too long.
+  int Push(const T& v);
+
+  int GetLength() const { return length; }
+
+  // Gets the recursion in the form of FindMinimumLinearRecursion.
+  std::vector<T> GetRecursion() const;
+
+ private:
+  std::vector<T> g;
+  int size;
+
+  // Connection polynomials with c[0] = b[0] = 1: c is the current one, and b
+  // the one before the last change of length. t is a buffer.
+  // g[n] + \sum_{i=1}^{length} c[i] g[n-i] = 0 for all length <= n < size.
+  std::vector<T> c;
+  std::vector<T> b;
+  std::vector<T> t;
+  int length;
+  int bLength;
+  // Number of terms since b was replaced.
+  int shift;
+  // The inverse of the discrepancy when b was replaced.
+  T bInv;
+};
+
+template<typename T>
+void BerlekampMassey<T>::Reset(int capacity) {
+  if (int(c.size()) < capacity+1) {
+    g.resize(capacity);
+    c.resize(capacity+1);
+    b.resize(capacity+1);
+    t.resize(capacity+1);
+  }
+  size = 0;
+  c[0] = b[0] = T(1);
+  length = bLength = 0;
+  shift = 1;
+  bInv = T(1);
+}
+
+template<typename T>
+int BerlekampMassey<T>::Push(const T& v) {
+  assert(size < int(g.size()));
+  const int n = size;
+  g[size++] = v;
+
+  T d = v;
+  for (int i = 1; i <= length; i++) d += c[i] * g[n-i];
+  if (d == 0) {
+    shift++;
+    return length;
+  }
+
+  const T coef = d * bInv;
+  if (2*length <= n) {
+    // The recursion gets longer, and the current one becomes b.
+    const int newLength = n+1-length;
+    std::copy(c.begin(), c.begin()+length+1, t.begin());
+    std::fill(c.begin()+length+1, c.begin()+newLength+1, T(0));
+    for (int i = 0; i <= bLength; i++) c[i+shift] -= coef * b[i];
+
+    b.swap(t);
+    bLength = length;
+    length = newLength;
+    bInv = T(1) / d;
+    shift = 1;
+  } else {
+    for (int i = 0; i <= bLength; i++) c[i+shift] -= coef * b[i];
+    shift++;
+  }
+  return length;
+}
+
+template<typename T>
+std::vector<T> BerlekampMassey<T>::GetRecursion() const {
+  // g[n] = \sum_k res[k] g[n-length+k]
+  std::vector<T> res(length);
+  for (int k = 0; k < length; k++) res[k] = -c[length-k];
+  return res;
+}
+
 // Berlekamp-Massey algorithm to find minimum linear recursion of given sequence g.
 template<typename T>
 std::vector<T> FindMinimumLinearRecursion(const std::vector<T>& g)
 {
-  std::vector<T> recursion, recursion_last;
-  T last_value = T(1);
-  int last_index = -1;
-
-  for (int i = 0; i < g.size(); i++) {
-    T v = g[i];
-    for (int j = 0; j < recursion.size(); j++)
-      v += recursion[j] * g[i-1-j];
-    if (v == 0) continue;
-
-    // v != 0, should fix the recursion
-    std::vector<T> t = recursion;
-
-    int l = recursion.size();
-    for (int j = 0; j <= recursion_last.size(); j++) {
-      int r_index = i+j-last_index;
-      while (recursion.size() < r_index)
-        recursion.push_back(0);
-      T term = (j == 0) ? T(1) : recursion_last[j-1];
-      recursion[r_index-1] -= v/last_value*term;
-    }
+  BerlekampMassey<T> bm(g.size());
+  for (const T& v : g) bm.Push(v);
+  return bm.GetRecursion();
+}
 
-    if (2*l <= i) {
-      recursion_last = t;
-      last_index = i;
-      last_value = v;
+// Finds the minimum linear recursions of many sequences, on given number of
+// threads (all cores if threads <= 0). Each worker reuses one
+// BerlekampMassey.
+//
+// A sequence is given up as soon as its recursion is longer than max_length
+// (if max_length >= 0). Its result is then empty, and (*aborted)[i] is set if
+// aborted is given.
+template<typename T>
+std::vector<std::vector<T>> FindMinimumLinearRecursions(
+    const std::vector<std::vector<T>>& gs, int max_length = -1,
+    int threads = 1, std::vector<bool>* aborted = nullptr) {
+  if (threads <= 0) threads = DefaultThreadCount();
+  int capacity = 0;
+  for (const auto& g : gs) capacity = std::max<int>(capacity, g.size());
+
+  std::vector<std::vector<T>> res(gs.size());
+  std::vector<char> given_up(gs.size(), 0);
+  std::vector<std::unique_ptr<BerlekampMassey<T>>> workers;
+  for (int w = 0; w < threads; w++)
+    workers.emplace_back(new BerlekampMassey<T>(capacity));
+
+  ParallelFor(0, gs.size(), threads,
+      [&gs, &res, &given_up, &workers, max_length](llong i, int w) {
+    BerlekampMassey<T>& bm = *workers[w];
+    bm.Reset(gs[i].size());
+    for (const T& v : gs[i]) {
+      int length = bm.Push(v);
+      if (max_length >= 0 && length > max_length) {
+        given_up[i] = 1;
+        return;
+      }
     }
-  }
+    res[i] = bm.GetRecursion();
+  });
 
-  for (int i = 0; i < recursion.size(); i++)
-    recursion[i] = -recursion[i];
-  reverse(recursion.begin(), recursion.end());
-  return recursion;
+  if (aborted != nullptr) aborted->assign(given_up.begin(), given_up.end());
+  return res;
 }
 
+template<typename T>
+std::vector<T> FindNthElementLinearRepresenationFast(
+    const std::vector<T>& c, const std::vector<bool>& bin);
+
 // Represents n-th term with linear combination of first M terms.
 // All terms with index >= M should follow the given linear recursion c
 // (and c has size equal to M).
@@ -65,6 +182,9 @@ template<typename T>
 std::vector<T> FindNthElementLinearRepresenation(
     const std::vector<T>& c, const std::vector<bool>& bin) {
   int m = c.size();
+  if (ModularTraits<T>::kModular && m >= kPolyFftThreshold)
+    return FindNthElementLinearRepresenationFast(c, bin);
+
   std::vector<T> r(m, T(0));
 
   int idx = 0;
@@ -76,8 +196,9 @@ std::vector<T> FindNthElementLinearRepresenation(
     return r;
   }
 
-  // starts with x[1]
-  r[1] = T(1);
+  // starts with x[1], which is already reduced when m = 1
+  if (m == 1) r[0] = c[0];
+  else r[1] = T(1);
   for (int l = idx+1; l < bin.size(); l++) {
     std::vector<T> v(2*m, T(0));
     for (int i = 0; i < m; i++) for (int j = 0; j < m; j++)
@@ -98,6 +219,80 @@ std::vector<T> FindNthElementLinearRepresenation(
   return r;
 }
 
+// Same with above method, but squares and reduces x^n modulo the recursion
+// polynomial with fast multiplication and division, so it runs in
+// O(m log m log n) when T is modular (see polynomial.h). The buffers are
+// reused across all bits.
+template<typename T>
+std::vector<T> FindNthElementLinearRepresenationFast(
+    const std::vector<T>& c, const std::vector<bool>& bin) {
+  int m = c.size();
+
+  // x^m = \sum_j c[j] x^j
+  std::vector<T> poly(m+1);
+  for (int i = 0; i < m; i++) poly[i] = -c[i];
+  poly[m] = T(1);
+  PolyModulus<T> modulus(poly);
+
+  std::vector<T> r(m, T(0)), v;
+  const int bits = bin.size();
+  int idx = 0;
+  for (; idx < bits; idx++)
+    if (bin[idx]) break;
+  if (idx == bits) {
+    r[0] = T(1);
+    return r;
+  }
+
+  r = {T(0), T(1)};
+  modulus.Reduce(r);
+  for (int l = idx+1; l < bits; l++) {
+    PolyMultiply(r, r, v);
+    if (bin[l]) v.insert(v.begin(), T(0));
+    modulus.Reduce(v);
+    r.swap(v);
+  }
+  return r;
+}
+
+// Gets [x^n] P(x)/Q(x) with Bostan-Mori's algorithm. Q[0] must be
+// invertible.
+//
+// P(x)/Q(x) = P(x)Q(-x) / V(x^2), where V(x^2) = Q(x)Q(-x) is even. So the
+// n-th coefficient is the floor(n/2)-th one of U_{n%2}(x)/V(x), where U_0 and
+// U_1 are the even and odd parts of P(x)Q(-x). Each bit of n takes two
+// multiplications of the size of Q, with fast multiplication for modular T
+// (see polynomial.h).
+template<typename T>
+T FindNthCoefficient(std::vector<T> p, std::vector<T> q,
+                     const std::vector<bool>& bin) {
+  assert(!q.empty());
+  std::vector<T> qneg, u, v;
+  for (int l = bin.size()-1; l >= 0 && !p.empty(); l--) {
+    qneg = q;
+    for (int i = 1; i < int(qneg.size()); i += 2) qneg[i] = -qneg[i];
+    PolyMultiply(p, qneg, u);
+    PolyMultiply(q, qneg, v);
+
+    p.clear();
+    const int usize = u.size(), vsize = v.size();
+    for (int i = bin[l] ? 1 : 0; i < usize; i += 2) p.push_back(u[i]);
+    q.clear();
+    for (int i = 0; i < vsize; i += 2) q.push_back(v[i]);
+  }
+  return p.empty() ? T(0) : p[0] / q[0];
+}
+
+// Same with above method, with n in normal form.
+template<typename T>
+T FindNthCoefficient(const std::vector<T>& p, const std::vector<T>& q,
+                     llong n) {
+  std::vector<bool> bin;
+  for (; n != 0; n /= 2) bin.push_back(n%2 == 1);
+  reverse(bin.begin(), bin.end());
+  return FindNthCoefficient(p, q, bin);
+}
+
 }  // namespace algo
 
 #endif  // ALGO_LINEAR_RECURSION_H_
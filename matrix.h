@@ -1,6 +1,8 @@
 #ifndef ALGO_MATRIX_H_
 #define ALGO_MATRIX_H_
 
+#include <vector>
+
 #include "defs.h"
 
 namespace algo {
@@ -27,7 +29,7 @@ Matrix<T, n> operator+(const Matrix<T, n>& m1, const Matrix<T, n>& m2) {
   for (int i = 0; i < n; i++)
     for (int j = 0; j < n; j++)
       res[i][j] = m1[i][j] + m2[i][j];
-  return std::move(res);
+  return res;
 }
 
 template<typename T, int n>
@@ -37,7 +39,7 @@ Matrix<T, n> operator*(const Matrix<T, n>& m1, const Matrix<T, n>& m2) {
     for (int j = 0; j < n; j++)
       for (int k = 0; k < n; k++)
         res[i][j] += m1[i][k] * m2[k][j];
-  return std::move(res);
+  return res;
 }
 
 // Returns m^p
@@ -47,7 +49,7 @@ Matrix<T, n> pow(const Matrix<T, n>& m, llong p)
   if (p == 0) {
     Matrix<T, n> res;
     for (int i = 0; i < n; i++) res[i][i] = T(1);
-    return std::move(res);
+    return res;
   }
 
   int len = 0;
@@ -58,26 +60,70 @@ Matrix<T, n> pow(const Matrix<T, n>& m, llong p)
     r *= r;
     if (p&(1LL<<i)) r *= m;
   }
-  return std::move(r);
+  return r;
 }
 
 // Return m^0 + m^1 + ... + m^p
+//
+// Walks the bits of p+1 from the highest one, carrying P = m^k together with
+// S = m^0 + ... + m^{k-1}. Doubling k takes S += P*S and P = P*P, and adding
+// one takes S += P and P = P*m, so it needs at most 3*log(p) products.
 template<typename T, int n>
 Matrix<T, n> powSum(const Matrix<T, n>& m, llong p)
 {
-  Matrix<T, n> identity = pow(m, 0);
-  if (p == 0) return identity;
-
+  llong k = p+1;
   int len = 0;
-  for (llong t = p; t != 1; t /= 2) len++;
+  for (llong t = k; t != 1; t /= 2) len++;
 
-  Matrix<T, n> r = m;
+  // k = 1
+  Matrix<T, n> power = m, sum = pow(m, 0);
   for (int i = len-1; i >= 0; i--) {
-    r += r*pow(m, p>>(i+1));
-    if (p&(1LL<<i)) r += pow(m, p>>i);
+    sum += power*sum;
+    if (i > 0 || (k&1)) power *= power;
+    if (k&(1LL<<i)) {
+      sum += power;
+      if (i > 0) power *= m;
+    }
+  }
+  return sum;
+}
+
+// Returns m*v
+template<typename T, int n>
+std::vector<T> operator*(const Matrix<T, n>& m, const std::vector<T>& v) {
+  std::vector<T> res(n, T(0));
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      res[i] += m[i][j] * v[j];
+  return res;
+}
+
+// Return (m^0 + m^1 + ... + m^p) * v
+//
+// Only the squarings m^(2^i) are matrix products. With u_i = S_{2^i} v, where
+// S_k = m^0 + ... + m^{k-1}, u_{i+1} = u_i + m^(2^i) u_i, and the bits of p+1
+// are combined from the lowest one by S_{2^i+r} v = u_i + m^(2^i) S_r v.
+// So it needs log(p) matrix products and 2*log(p) matrix-vector products.
+template<typename T, int n>
+std::vector<T> powSum(const Matrix<T, n>& m, llong p, const std::vector<T>& v)
+{
+  std::vector<T> res(n, T(0)), u = v;
+  Matrix<T, n> square = m;
+  bool empty = true;
+  for (llong k = p+1; k > 0; k >>= 1) {
+    if (k&1) {
+      std::vector<T> next = empty ? res : square*res;
+      for (int i = 0; i < n; i++) next[i] += u[i];
+      res = next;
+      empty = false;
+    }
+    if (k > 1) {
+      std::vector<T> su = square*u;
+      for (int i = 0; i < n; i++) u[i] += su[i];
+      square *= square;
+    }
   }
-  r += identity;
-  return std::move(r);
+  return res;
 }
 
 }  // namespace algo
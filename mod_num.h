@@ -75,6 +75,26 @@ class ModNum {
   int n;
 };
 
+// Describes how an element type can be handled as plain residues, so that
+// generic code (e.g. matrix products) can accumulate in 64-bit integers and
+// reduce once instead of after every operation.
+//
+// kModular is false for all types by default. Modular types set it to true,
+// and provide kModulus and the conversions from and to the residue in
+// [0, kModulus).
+template <typename T>
+struct ModularTraits {
+  static const bool kModular = false;
+};
+
+template <int P>
+struct ModularTraits<ModNum<P>> {
+  static const bool kModular = true;
+  static const llong kModulus = P;
+  static ullong ToResidue(const ModNum<P>& x) { return int(x); }
+  static ModNum<P> FromResidue(ullong x) { return ModNum<P>(llong(x)); }
+};
+
 }  // namespace algo
 
 #endif  // ALGO_MOD_NUM_H
@@ -71,7 +71,8 @@ int inverse(int a, int p)
 {
   // a*x + p*y = 1
   llong x, y;
-  assert(ExtendGcd<llong>(a, p, 1, x, y));
+  bool invertible = ExtendGcd<llong>(a, p, 1, x, y);
+  assert(invertible);
   return x;
 }
 
@@ -3,9 +3,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "checkpoint.h"
 #include "defs.h"
+#include "sieve_probe.h"
 
 namespace algo {
 
@@ -19,17 +23,36 @@ class MultiplicitivePrimeSum {
   //     function f. I.e., mf_sum(n) = (\sum_{i=1}^n f(i)).
   void GetSumOverPrimes(NtFunctionT<T> mf_sum);
 
+  // Same as above, but snapshots the tables into the checkpoint file at path
+  // every "interval" seconds, and resumes from the file if it holds an
+  // unfinished run with the same N. mf_sum must be the same function across
+  // the resumed runs. The finished tables stay in the file, and can be queried
+  // later via MappedPrimeSum.
+  // Returns false if the checkpoint file cannot be opened.
+  bool GetSumOverPrimes(NtFunctionT<T> mf_sum, const std::string& path,
+                        double interval);
+
   // Gets the \sum{ f(p) : 0 < p <= k and p is a prime }.
   T GetSum(llong k) const {
     return k <= SG_N ? sum[k] : sum2[N/k];
   }
 
+  // Reports phase timings and progress to listener. Only works when compiled
+  // with ALGO_INSTRUMENTATION, see sieve_probe.h.
+  void SetListener(SieveListener* listener, double interval = 1.0) {
+    probe.SetListener(listener, interval);
+  }
+  SieveStats GetStats() const { return probe.GetStats(); }
+
  private:
   void update(T& a, llong index, int pIndex) {
     int p = primes[pIndex];
     a -= (GetSum(index/p) - GetSum(p-1)) * fp[pIndex];
   }
 
+  void sieve(NtFunctionT<T> mf_sum, SieveCheckpoint<T>* checkpoint);
+  void snapshot(SieveCheckpoint<T>* checkpoint, int pIndex, bool finished);
+
   llong N;
   // SG_N = floor(N^{1/2})
   int SG_N;
@@ -45,6 +68,8 @@ class MultiplicitivePrimeSum {
   // To simplify the calculation, we define 1 to be a prime too
   std::vector<T> sum;
   std::vector<T> sum2;
+
+  SieveProbe probe;
 };
 
 template <typename T>
@@ -64,25 +89,114 @@ MultiplicitivePrimeSum<T>::MultiplicitivePrimeSum(llong n) : N(n) {
 
 template <typename T>
 void MultiplicitivePrimeSum<T>::GetSumOverPrimes(NtFunctionT<T> mf_sum) {
-  for (int i = 0; i < primes.size(); i++)
-    fp[i] = mf_sum(primes[i]) - mf_sum(primes[i]-1);
-  for (int i = 0; i <= SG_N; i++) sum[i] = mf_sum(i);
-  for (int i = 1; i <= SG_N; i++) sum2[i] = mf_sum(N/i);
+  sieve(mf_sum, nullptr);
+}
+
+template <typename T>
+bool MultiplicitivePrimeSum<T>::GetSumOverPrimes(
+    NtFunctionT<T> mf_sum, const std::string& path, double interval) {
+  // Section 0 is sum, section 1 is sum2. Both are rewritten on every snapshot.
+  auto checkpoint = SieveCheckpoint<T>::Create(
+      path, kPrimeSumCheckpoint, N,
+      {{SG_N+1LL, true}, {SG_N+1LL, true}}, interval);
+  if (checkpoint == nullptr) return false;
+
+  sieve(mf_sum, checkpoint.get());
+  return true;
+}
 
-  int pIndex = 0;
-  for (llong p : primes) {
+template <typename T>
+void MultiplicitivePrimeSum<T>::sieve(NtFunctionT<T> mf_sum,
+                                      SieveCheckpoint<T>* checkpoint) {
+  const int count = primes.size();
+  int start = 0;
+  {
+    SieveProbe::Phase phase(&probe, "init");
+    for (int i = 0; i < count; i++)
+      fp[i] = mf_sum(primes[i]) - mf_sum(primes[i]-1);
+    probe.Count(kCallbackCalls, 2*primes.size());
+
+    // The checkpoint progress is the number of primes already sieved.
+    if (checkpoint != nullptr && checkpoint->GetProgress() >= 0) {
+      std::copy(checkpoint->Read(0), checkpoint->Read(0)+SG_N+1, sum.begin());
+      std::copy(checkpoint->Read(1), checkpoint->Read(1)+SG_N+1, sum2.begin());
+      start = checkpoint->GetProgress();
+    } else {
+      for (int i = 0; i <= SG_N; i++) sum[i] = mf_sum(i);
+      for (int i = 1; i <= SG_N; i++) sum2[i] = mf_sum(N/i);
+      probe.Count(kCallbackCalls, 2*SG_N+1);
+    }
+  }
+
+  SieveProbe::Phase phase(&probe, "sieve");
+  for (int pIndex = start; pIndex < count; pIndex++) {
+    llong p = primes[pIndex];
     // After each stage, sum_p and sum2_p contains all numbers that are:
     // - either a prime number, or
     // - a composite number whose smallest prime factor is >= primes[i]
-    llong minN = p*(p-1);
-    for (int j = 1; j <= SG_N && N/j > minN; j++)
+    llong minN = p*(p-1), updates = 0;
+    for (int j = 1; j <= SG_N && N/j > minN; j++, updates++)
       update(sum2[j], N/j, pIndex);
-    for (int j = SG_N; j >= 0 && j > minN; j--)
+    for (int j = SG_N; j >= 0 && j > minN; j--, updates++)
       update(sum[j], j, pIndex);
-    pIndex++;
+    probe.Count(kQuotientUpdates, updates);
+    probe.Progress("sieve", pIndex+1, primes.size());
+
+    if (checkpoint != nullptr && checkpoint->Due())
+      snapshot(checkpoint, pIndex+1, false);
   }
+
+  if (checkpoint != nullptr && !checkpoint->IsFinished())
+    snapshot(checkpoint, primes.size(), true);
+}
+
+template <typename T>
+void MultiplicitivePrimeSum<T>::snapshot(SieveCheckpoint<T>* checkpoint,
+                                         int pIndex, bool finished) {
+  std::copy(sum.begin(), sum.end(), checkpoint->Write(0));
+  std::copy(sum2.begin(), sum2.end(), checkpoint->Write(1));
+  checkpoint->Commit(pIndex, finished);
 }
 
+// Read-only view of the tables finished by
+// MultiplicitivePrimeSum::GetSumOverPrimes with a checkpoint file. Queries are
+// answered directly from the mapped file.
+template <typename T>
+class MappedPrimeSum {
+ public:
+  // Returns nullptr if the file does not hold a finished prime sum table.
+  static std::unique_ptr<MappedPrimeSum<T>> Open(const std::string& path) {
+    auto checkpoint = SieveCheckpoint<T>::OpenReadOnly(
+        path, kPrimeSumCheckpoint);
+    if (checkpoint == nullptr) return nullptr;
+    return std::unique_ptr<MappedPrimeSum<T>>(
+        new MappedPrimeSum<T>(std::move(checkpoint)));
+  }
+
+  llong GetN() const { return N; }
+
+  // Gets the \sum{ f(p) : 0 < p <= k and p is a prime }.
+  // Only works for k = floor(N/m) for some m.
+  T GetSum(llong k) const {
+    return k <= SG_N ? sum[k] : sum2[N/k];
+  }
+
+ private:
+  MappedPrimeSum(std::unique_ptr<SieveCheckpoint<T>> checkpoint_)
+      : checkpoint(std::move(checkpoint_)) {
+    N = checkpoint->GetN();
+    SG_N = checkpoint->GetSectionSize(0)-1;
+    sum = checkpoint->Read(0);
+    sum2 = checkpoint->Read(1);
+  }
+
+  std::unique_ptr<SieveCheckpoint<T>> checkpoint;
+  llong N;
+  int SG_N;
+  const T* sum;
+  const T* sum2;
+};
+
 }  // namespace algo
 
 #endif  // ALGO_MULTIPLICITIVE_PRIME_SUM_H_
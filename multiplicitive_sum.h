@@ -2,6 +2,7 @@
 #define ALGO_MULTIPLICITIVE_SUM_H_
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
 #include <memory>
@@ -10,6 +11,8 @@
 #include "defs.h"
 #include "modular.h"
 #include "multiplicitive_prime_sum.h"
+#include "parallel.h"
+#include "sieve_probe.h"
 
 namespace algo {
 
@@ -69,7 +72,48 @@ class MultiplicitiveSum {
   T PrefixSum(MultiplicitiveFunctionT<T> mf,
               const MultiplicitiveCombination<T>& mc);
 
+  // Same as above, but sums over the multiples on given number of threads
+  // (all cores if threads <= 0). mf must be safe to call concurrently.
+  T PrefixSum(MultiplicitiveFunctionT<T> mf,
+              NtFunctionT<T> mf_sum, int threads);
+  T PrefixSum(MultiplicitiveFunctionT<T> mf,
+              const MultiplicitiveCombination<T>& mc, int threads);
+
+  // Calculates the prefix sums of f at all indices m where floor(N/m') = m
+  // for some m', in one pass. It runs the sum over the multiples bottom-up
+  // over these indices instead of walking the tree from N.
+  // The parameters are the same as PrefixSum, and the results can be
+  // accessed via "GetPrefixSum" method.
+  void CalculatePrefixSums(MultiplicitiveFunctionT<T> mf,
+                           NtFunctionT<T> mf_sum);
+  void CalculatePrefixSums(MultiplicitiveFunctionT<T> mf,
+                           const MultiplicitiveCombination<T>& mc);
+
+  // Gets the prefix sum of index m. Must be called after CalculatePrefixSums.
+  T GetPrefixSum(llong m) const {
+    return m <= SG_N ? prefix[m] : prefix2[N/m];
+  }
+
+  // Reports phase timings and progress to listener. Only works when compiled
+  // with ALGO_INSTRUMENTATION, see sieve_probe.h.
+  void SetListener(SieveListener* listener, double interval = 1.0) {
+    probe.SetListener(listener, interval);
+  }
+  SieveStats GetStats() const { return probe.GetStats(); }
+
  private:
+  // A node in the tree of numbers ordered by their smallest prime factors.
+  // It stands for all multiples m of X where m/X only has prime factors
+  // greater than primes[pIndex].
+  struct Node {
+    llong X;
+    T fx;
+    int pIndex;
+  };
+
+  // Nodes with X below N/kParallelSplit are not handed out to other workers.
+  static const llong kParallelSplit = 1<<12;
+
   // Calculates \sum{ f(p) : 0 < p <= M and p is a prime } for some M.
   void GetSumOverPrimes(const MultiplicitiveCombination<T>& mc);
 
@@ -84,6 +128,17 @@ class MultiplicitiveSum {
   T GetSumOverMultiples(MultiplicitiveFunctionT<T> mf,
                         llong X, T fx, int pIndex) const;
 
+  // Same as GetSumOverMultiples(mf, N, 1, -1) but with multiple threads.
+  T GetSumOverMultiplesParallel(MultiplicitiveFunctionT<T> mf,
+                                int threads) const;
+
+  // Returns the sum of the direct children of given node, and calls
+  // emit(child) for every child which has children itself. Adds the number
+  // of mf calls to calls.
+  template <typename Emit>
+  T expand(const MultiplicitiveFunctionT<T>& mf, const Node& node,
+           Emit&& emit, llong& calls) const;
+
   T getSumP(llong k) const {
     return k <= SG_N ? sum[k] : sum2[N/k];
   }
@@ -100,6 +155,12 @@ class MultiplicitiveSum {
   // To simplify the calculation, we define 1 to be a prime too
   std::vector<T> sum;
   std::vector<T> sum2;
+
+  // Results of CalculatePrefixSums, in the same layout as sum and sum2.
+  std::vector<T> prefix;
+  std::vector<T> prefix2;
+
+  mutable SieveProbe probe;
 };
 
 template <typename T>
@@ -117,6 +178,7 @@ MultiplicitiveSum<T>::MultiplicitiveSum(llong n) : N(n) {
 template <typename T>
 void MultiplicitiveSum<T>::GetSumOverPrimes(
     const MultiplicitiveCombination<T>& mc) {
+  SieveProbe::Phase phase(&probe, "primes");
   sum = std::vector<T>(SG_N+1, T(0));
   sum2 = std::vector<T>(SG_N+1, T(0));
 
@@ -129,30 +191,36 @@ void MultiplicitiveSum<T>::GetSumOverPrimes(
       sum2[i] += coef*mps.GetSum(N/i);
     }
   }
+  probe.Merge(mps.GetStats());
 }
 
 template <typename T>
-T MultiplicitiveSum<T>::GetSumOverMultiples(
-    MultiplicitiveFunctionT<T> mf, llong X, T fx, int pIndex) const {
+template <typename Emit>
+T MultiplicitiveSum<T>::expand(const MultiplicitiveFunctionT<T>& mf,
+                               const Node& node, Emit&& emit,
+                               llong& calls) const {
   T res = 0;
 
   // Categorize the multiples Y into two buckets and calculate them separately:
   // 1. Y has only 1 largest prime factor
   // 2. Y has >= 2 largest prime factors
-  for (int i = pIndex+1; i < primes.size(); i++) {
-    if (X == N) printf("%d/%d\n", i, primes.size());
+  const int count = primes.size();
+  for (int i = node.pIndex+1; i < count; i++) {
     int p = primes[i];
-    if (1LL*p*p > X) break;
+    if (1LL*p*p > node.X) break;
 
-    llong nextX = X;
+    llong nextX = node.X;
     for (int j = 1; nextX >= p; j++) {
       nextX /= p;
-      T nextF = fx * mf(p, j);
+      T nextF = node.fx * mf(p, j);
+      calls++;
       if (nextX > p) {
         // Summarize numbers in 1st category
-        llong sumP = getSumP(nextX) - getSumP(p);
+        T sumP = getSumP(nextX) - getSumP(p);
         res += nextF * sumP;
-        res += GetSumOverMultiples(mf, nextX, nextF, i);
+        // The child only has children if the next prime fits twice.
+        if (i+1 < count && 1LL*primes[i+1]*primes[i+1] <= nextX)
+          emit(Node{nextX, nextF, i});
       }
       // Summarize numbers in 2nd category
       if (j >= 2) res += nextF;
@@ -161,6 +229,91 @@ T MultiplicitiveSum<T>::GetSumOverMultiples(
   return res;
 }
 
+template <typename T>
+T MultiplicitiveSum<T>::GetSumOverMultiples(
+    MultiplicitiveFunctionT<T> mf, llong X, T fx, int pIndex) const {
+  SieveProbe::Phase phase(&probe, "multiples");
+  llong calls = 0, nodes = 1;
+
+  std::vector<Node> tasks;
+  T res = expand(mf, Node{X, fx, pIndex},
+                 [&tasks](const Node& child) { tasks.push_back(child); },
+                 calls);
+
+  // Walks the subtree of each child depth-first with an explicit stack.
+  std::vector<Node> stack;
+  auto emit = [&stack](const Node& child) { stack.push_back(child); };
+  const int count = tasks.size();
+  for (int i = 0; i < count; i++) {
+    stack.push_back(tasks[i]);
+    while (!stack.empty()) {
+      Node node = stack.back();
+      stack.pop_back();
+      res += expand(mf, node, emit, calls);
+      nodes++;
+    }
+    probe.Progress("multiples", i+1, count);
+  }
+
+  probe.Count(kCallbackCalls, calls);
+  probe.Count(kRecursionNodes, nodes);
+  return res;
+}
+
+template <typename T>
+T MultiplicitiveSum<T>::GetSumOverMultiplesParallel(
+    MultiplicitiveFunctionT<T> mf, int threads) const {
+  // The subtrees of the top-level primes are very unbalanced, so they are
+  // scheduled as separate tasks, and the large nodes inside them can be
+  // stolen by idle workers as well.
+  SieveProbe::Phase phase(&probe, "multiples");
+  llong calls = 0;
+
+  std::vector<Node> tasks;
+  T res = expand(mf, Node{N, T(1), -1},
+                 [&tasks](const Node& child) { tasks.push_back(child); },
+                 calls);
+  probe.Count(kCallbackCalls, calls);
+  probe.Count(kRecursionNodes, 1);
+
+  WorkStealingPool<Node> pool(threads);
+  std::vector<T> partial(pool.GetThreads(), T(0));
+  llong cutoff = N/kParallelSplit;
+  // Tasks are also pushed while running, so progress is reported as
+  // finished tasks against all tasks created so far.
+  std::atomic<llong> created(tasks.size()), finished(0);
+
+  pool.Run(tasks, [this, &mf, &partial, cutoff, &created, &finished](
+      const Node& task, int worker,
+      const typename WorkStealingPool<Node>::PushFunction& push) {
+    T sum = 0;
+    llong calls = 0, nodes = 0;
+    std::vector<Node> stack = {task};
+    auto emit = [&stack, &push, &created, cutoff](const Node& child) {
+      if (child.X >= cutoff) {
+        created++;
+        push(child);
+      } else {
+        stack.push_back(child);
+      }
+    };
+    while (!stack.empty()) {
+      Node node = stack.back();
+      stack.pop_back();
+      sum += expand(mf, node, emit, calls);
+      nodes++;
+    }
+    partial[worker] += sum;
+
+    probe.Count(kCallbackCalls, calls);
+    probe.Count(kRecursionNodes, nodes);
+    probe.Progress("multiples", ++finished, created);
+  });
+
+  for (const T& sum : partial) res += sum;
+  return res;
+}
+
 template <typename T>
 T MultiplicitiveSum<T>::PrefixSum(MultiplicitiveFunctionT<T> mf,
                                   NtFunctionT<T> mf_sum) {
@@ -179,6 +332,82 @@ T MultiplicitiveSum<T>::PrefixSum(MultiplicitiveFunctionT<T> mf,
   return res;
 }
 
+template <typename T>
+T MultiplicitiveSum<T>::PrefixSum(MultiplicitiveFunctionT<T> mf,
+                                  NtFunctionT<T> mf_sum, int threads) {
+  typename MultiplicitiveCombination<T>::Builder builder;
+
+  builder.AddFunction(1, mf_sum);
+  return PrefixSum(mf, builder.Build(), threads);
+}
+
+template <typename T>
+T MultiplicitiveSum<T>::PrefixSum(MultiplicitiveFunctionT<T> mf,
+                                  const MultiplicitiveCombination<T>& mc,
+                                  int threads) {
+  GetSumOverPrimes(mc);
+
+  T res = GetSumOverMultiplesParallel(mf, threads) + getSumP(N) - getSumP(1) + 1;
+  return res;
+}
+
+template <typename T>
+void MultiplicitiveSum<T>::CalculatePrefixSums(
+    MultiplicitiveFunctionT<T> mf, NtFunctionT<T> mf_sum) {
+  typename MultiplicitiveCombination<T>::Builder builder;
+
+  builder.AddFunction(1, mf_sum);
+  CalculatePrefixSums(mf, builder.Build());
+}
+
+template <typename T>
+void MultiplicitiveSum<T>::CalculatePrefixSums(
+    MultiplicitiveFunctionT<T> mf, const MultiplicitiveCombination<T>& mc) {
+  GetSumOverPrimes(mc);
+
+  SieveProbe::Phase phase(&probe, "prefix sums");
+  prefix = sum;
+  prefix2 = sum2;
+
+  // Before handling primes[k], GetPrefixSum(v) holds the sum of f(m) over
+  // 1 < m <= v where m is either a prime, or a composite whose smallest prime
+  // factor is greater than primes[k] (plus getSumP(1) for the prime 1).
+  // Primes are added from the largest one, and indices from the largest one,
+  // so GetPrefixSum(v/p^e) still holds the value of the previous stage.
+  std::vector<T> fpe;
+  llong calls = 0, updates = 0;
+  for (int k = primes.size()-1; k >= 0; k--) {
+    llong p = primes[k];
+    T sp = getSumP(p);
+
+    fpe.assign(1, T(1));
+    for (llong pe = 1; pe <= N/p; pe *= p) fpe.push_back(mf(p, fpe.size()));
+    calls += fpe.size()-1;
+
+    auto update = [this, p, &sp, &fpe](T& h, llong v) {
+      llong pe = p;
+      for (int e = 1; pe <= v/p; pe *= p, e++)
+        h += fpe[e] * (GetPrefixSum(v/pe) - sp) + fpe[e+1];
+    };
+    for (int j = 1; j <= SG_N && N/j >= p*p; j++, updates++)
+      update(prefix2[j], N/j);
+    for (llong v = SG_N; v >= p*p; v--, updates++)
+      update(prefix[v], v);
+
+    probe.Progress("prefix sums", primes.size()-k, primes.size());
+  }
+  probe.Count(kCallbackCalls, calls);
+  probe.Count(kQuotientUpdates, updates);
+
+  // Replaces the prime 1 with f(1) = 1.
+  T one = getSumP(1);
+  for (int i = 1; i <= SG_N; i++) {
+    prefix[i] += 1 - one;
+    prefix2[i] += 1 - one;
+  }
+  prefix[0] = T(0);
+}
+
 }  // namespace algo
 
 #endif  // ALGO_MULTIPLICITIVE_SUM_H_
@@ -2,27 +2,62 @@
 #define ALGO_MULTIPLICITIVE_SUM2_H_
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "checkpoint.h"
 #include "defs.h"
 #include "division_enumerator.h"
+#include "parallel.h"
+#include "sieve_probe.h"
 
 namespace algo {
 
 template<typename T>
 class MultiplicitiveSum2 {
  public:
-  MultiplicitiveSum2(llong n) : N(n) {
-    BF_N = llong(pow(N, 2.0/3));
+  MultiplicitiveSum2(llong n) : MultiplicitiveSum2(n, llong(pow(n, 2.0/3))) {}
+
+  // Uses bf_n as the threshold under which all prefix sums are calculated by
+  // sieving. It is clamped into [sqrt(n), n], see ChooseSmallThreshold.
+  MultiplicitiveSum2(llong n, llong bf_n) : N(n) {
     SG_N = int(pow(N, 1.0/2));
+    while (1LL*SG_N*SG_N > N) SG_N--;
+    while (1LL*(SG_N+1)*(SG_N+1) <= N) SG_N++;
+    BF_N = std::max<llong>(std::min(bf_n, N), SG_N);
+
+    // The small sums are built in segments of about sqrt(BF_N) numbers.
+    segmentSize = std::max<llong>(llong(sqrt(BF_N)), kMinSegmentSize);
 
     sum1 = std::make_unique<T[]>(SG_N+1);
     sum2 = std::make_unique<T[]>(SG_N+1);
     smallSum = std::make_unique<T[]>(BF_N+1);
   }
 
+  // Measured costs of the two parts of Calculate, in seconds.
+  struct Costs {
+    // Per number up to the threshold, for building the small sums.
+    double small_cost;
+    // Per block of the division enumeration, for the large sums.
+    double large_cost;
+  };
+
+  // Measures the costs by a small run of Calculate with given functions.
+  static Costs Calibrate(MultiplicitiveFunctionT<T> f,
+      NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum);
+
+  // Chooses the threshold which minimizes the estimated running time for n,
+  // while the tables stay within memory_bytes.
+  //
+  // Sieving up to B costs small_cost*B. Index N/i needs about 2*sqrt(N/i)
+  // blocks, so all indices above B cost about large_cost*4*N/sqrt(B). The sum
+  // is minimal at B = (2*N*large_cost/small_cost)^(2/3).
+  static llong ChooseSmallThreshold(llong n, llong memory_bytes,
+                                    const Costs& costs);
+
   // Calculates the prefix sum of given multiplicitive function in some fixed prefixes.
   // 
   // Input:
@@ -41,70 +76,294 @@ class MultiplicitiveSum2 {
   void Calculate(MultiplicitiveFunctionT<T> f,
       NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum);
 
+  // Same as above, but runs on given number of threads (all cores if
+  // threads <= 0). f, gPrefixSum and rPrefixSum must be safe to call
+  // concurrently.
+  void Calculate(MultiplicitiveFunctionT<T> f,
+      NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum, int threads);
+
+  // Same as above, but snapshots the progress into the checkpoint file at path
+  // every "interval" seconds, and resumes from the file if it holds an
+  // unfinished run with the same N. The finished tables stay in the file, and
+  // can be queried later via MappedMultiplicitiveSum2.
+  // Returns false if the checkpoint file cannot be opened.
+  bool Calculate(MultiplicitiveFunctionT<T> f,
+      NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum,
+      const std::string& path, double interval, int threads = 1);
+
   // Gets the prefix sum of index m. Must be called after method Calculate.
   T GetPrefixSum(llong m) const { return m <= BF_N ? smallSum[m] : sum2[N/m]; }
+
+  // Reports phase timings and progress to listener. Only works when compiled
+  // with ALGO_INSTRUMENTATION, see sieve_probe.h.
+  void SetListener(SieveListener* listener, double interval = 1.0) {
+    probe.SetListener(listener, interval);
+  }
+  SieveStats GetStats() const { return probe.GetStats(); }
+
+  // When enabled, gPrefixSum and rPrefixSum are evaluated exactly once at
+  // every index floor(N/m) before the convolution, and the convolution reads
+  // them from arrays. Recommended when the callbacks are expensive, as every
+  // argument they are called with is such an index anyway.
+  void SetCallbackCache(bool enabled) { cacheCallbacks = enabled; }
  
  private:
-  void CalculateSmallSums(MultiplicitiveFunctionT<T> f);
+  static const llong kMinSegmentSize = 1<<14;
+
+  void CalculateSmallSums(MultiplicitiveFunctionT<T> f, int threads);
+  void CalculateLargeSums(NtFunctionT<T> gPrefixSum,
+      NtFunctionT<T> rPrefixSum, SieveCheckpoint<T>* checkpoint, int threads);
  
   T CalculateIndex(NtFunctionT<T> gPrefixSum,
       NtFunctionT<T> rPrefixSum, llong m) const;
+
+  // Fills the callback caches for all indices needed by CalculateIndex.
+  void CacheCallbacks(NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum,
+                      int iMax, int threads);
+  T gCached(llong m) const { return m <= SG_N ? gSmall[m] : gLarge[N/m]; }
  
   llong N;
-  // BF_N = floor(N^{2/3})
+  // BF_N = floor(N^{2/3}) by default
   llong BF_N;
   // SG_N = floor(N^{1/2})
   int SG_N;
 
+  // Length of the segments which the small sums are calculated in.
+  llong segmentSize;
+
   std::unique_ptr<T[]> sum1;
   std::unique_ptr<T[]> sum2;
   std::unique_ptr<T[]> smallSum;
+
+  bool cacheCallbacks = false;
+  // gSmall[m] = gPrefixSum(m), gLarge[k] = gPrefixSum(N/k),
+  // rLarge[k] = rPrefixSum(N/k).
+  std::vector<T> gSmall;
+  std::vector<T> gLarge;
+  std::vector<T> rLarge;
+
+  mutable SieveProbe probe;
 };
 
 template <typename T>
-void MultiplicitiveSum2<T>::CalculateSmallSums(MultiplicitiveFunctionT<T> f) {
-  std::vector<bool> prime(BF_N+1, true);
-  std::vector<int> pFactor(BF_N+1, 0);
-
-  for (llong i = 2; i <= BF_N; i++) if (prime[i]) {
-    llong start = i*i;
-    if (start > BF_N) break;
-    for (llong j = start; j <= BF_N; j += i) {
-      prime[j] = false;
-      pFactor[j] = i;
+typename MultiplicitiveSum2<T>::Costs MultiplicitiveSum2<T>::Calibrate(
+    MultiplicitiveFunctionT<T> f, NtFunctionT<T> gPrefixSum,
+    NtFunctionT<T> rPrefixSum) {
+  const llong n = 1LL<<32, bf_n = 1LL<<20;
+  MultiplicitiveSum2<T> sample(n, bf_n);
+
+  auto start = std::chrono::steady_clock::now();
+  sample.CalculateSmallSums(f, 1);
+  auto middle = std::chrono::steady_clock::now();
+  sample.CalculateLargeSums(gPrefixSum, rPrefixSum, nullptr, 1);
+  auto end = std::chrono::steady_clock::now();
+
+  Costs costs;
+  costs.small_cost =
+      std::chrono::duration<double>(middle-start).count() / bf_n;
+  costs.large_cost =
+      std::chrono::duration<double>(end-middle).count() / (4*n/sqrt(bf_n));
+  return costs;
+}
+
+template <typename T>
+llong MultiplicitiveSum2<T>::ChooseSmallThreshold(
+    llong n, llong memory_bytes, const Costs& costs) {
+  double best = pow(2*n*costs.large_cost / std::max(costs.small_cost, 1e-12),
+                    2.0/3);
+
+  // Besides smallSum, there are 5 arrays of sqrt(n) for the large sums and
+  // the callback caches.
+  double sg = sqrt(n);
+  double limit = double(memory_bytes)/sizeof(T) - 5*(sg+1);
+
+  double res = std::min(std::min(best, limit), double(n));
+  return std::max(llong(res), llong(sg));
+}
+
+template <typename T>
+void MultiplicitiveSum2<T>::CalculateSmallSums(MultiplicitiveFunctionT<T> f,
+                                               int threads) {
+  SieveProbe::Phase phase(&probe, "small sums");
+
+  // Every number up to BF_N has at most one prime factor above sq.
+  llong sq = llong(sqrt(BF_N));
+  while ((sq+1)*(sq+1) <= BF_N) sq++;
+
+  std::vector<int> primes;
+  std::vector<bool> is_prime(sq+1, true);
+  for (int i = 2; i <= sq; i++) if (is_prime[i]) {
+    primes.push_back(i);
+    for (llong j = 1LL*i*i; j <= sq; j += i) is_prime[j] = false;
+  }
+
+  // fpe[k][e] = f(primes[k]^e) for all powers up to BF_N.
+  const int count = primes.size();
+  std::vector<std::vector<T>> fpe(count);
+  llong calls = 0;
+  for (int k = 0; k < count; k++) {
+    fpe[k].push_back(T(1));
+    for (llong pe = primes[k]; pe <= BF_N; pe *= primes[k]) {
+      fpe[k].push_back(f(primes[k], fpe[k].size()));
+      if (pe > BF_N/primes[k]) break;
     }
+    calls += fpe[k].size()-1;
   }
 
-  // Calculate the value of function f in smallSum.
-  smallSum[0] = T(0);
-  smallSum[1] = T(1);
-  for (llong i = 2; i <= BF_N; i++) {
-    if (prime[i]) {
-      smallSum[i] = f(i, 1);
-      continue;
+  // Calculates the values of f and their prefix sums segment by segment.
+  // The segments are independent, except that the total of all previous
+  // segments is added in a second pass.
+  llong segments = (BF_N+segmentSize)/segmentSize;
+  std::vector<T> totals(segments);
+  std::vector<std::vector<llong>> rems(threads, std::vector<llong>(segmentSize));
+  std::vector<llong> large_calls(threads, 0);
+
+  ParallelFor(0, segments, threads,
+      [this, &f, &primes, &fpe, &totals, &rems, &large_calls, count](
+          llong s, int w) {
+    llong lo = s*segmentSize, hi = std::min(lo+segmentSize, BF_N+1);
+    T* val = smallSum.get()+lo;
+    llong* rem = rems[w].data();
+    for (llong i = lo; i < hi; i++) {
+      val[i-lo] = T(1);
+      rem[i-lo] = i;
     }
 
-    int pc = 0, p = pFactor[i];
-    llong m = i;
-    for (; m % p == 0; m /= p) pc++;
-    smallSum[i] = smallSum[m] * f(p, pc);
+    for (int k = 0; k < count && primes[k] < hi; k++) {
+      llong p = primes[k];
+      for (llong m = std::max((lo+p-1)/p, 1LL)*p; m < hi; m += p) {
+        llong& r = rem[m-lo];
+        int e = 0;
+        do {
+          r /= p;
+          e++;
+        } while (r%p == 0);
+        val[m-lo] *= fpe[k][e];
+      }
+    }
+    for (llong i = lo; i < hi; i++) if (rem[i-lo] > 1) {
+      val[i-lo] *= f(rem[i-lo], 1);
+      large_calls[w]++;
+    }
+    if (lo == 0) val[0] = T(0);
+
+    for (llong i = lo+1; i < hi; i++) val[i-lo] += val[i-lo-1];
+    totals[s] = val[hi-lo-1];
+  });
+
+  for (llong c : large_calls) calls += c;
+  probe.Count(kCallbackCalls, calls);
+
+  T offset = T(0);
+  for (llong s = 0; s < segments; s++) {
+    T total = totals[s];
+    totals[s] = offset;
+    offset += total;
   }
-  
-  // Get the prefix sums.
-  for (int i = 1; i <= BF_N; i++)
-    smallSum[i] += smallSum[i-1];
+  ParallelFor(1, segments, threads, [this, &totals](llong s, int) {
+    llong lo = s*segmentSize, hi = std::min(lo+segmentSize, BF_N+1);
+    for (llong i = lo; i < hi; i++) smallSum[i] += totals[s];
+  });
 }
 
 template <typename T>
 void MultiplicitiveSum2<T>::Calculate(MultiplicitiveFunctionT<T> f,
     NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum) {
-  CalculateSmallSums(f);
+  Calculate(f, gPrefixSum, rPrefixSum, 1);
+}
 
+template <typename T>
+void MultiplicitiveSum2<T>::Calculate(MultiplicitiveFunctionT<T> f,
+    NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum, int threads) {
+  if (threads <= 0) threads = DefaultThreadCount();
+  CalculateSmallSums(f, threads);
+  CalculateLargeSums(gPrefixSum, rPrefixSum, nullptr, threads);
+}
+
+template <typename T>
+bool MultiplicitiveSum2<T>::Calculate(MultiplicitiveFunctionT<T> f,
+    NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum,
+    const std::string& path, double interval, int threads) {
+  if (threads <= 0) threads = DefaultThreadCount();
+
+  // Section 0 is smallSum, section 1 is sum2. Values in both are never
+  // changed once written, so no double buffering is needed.
+  auto checkpoint = SieveCheckpoint<T>::Create(
+      path, kMultiplicitiveSum2Checkpoint, N,
+      {{BF_N+1, false}, {SG_N+1LL, false}}, interval);
+  if (checkpoint == nullptr) return false;
+
+  // The checkpoint progress is the index i where all sum2[j] with j > i are
+  // calculated, or -1 if the small sums are not ready yet.
+  if (checkpoint->GetProgress() >= 0) {
+    std::copy(checkpoint->Read(0), checkpoint->Read(0)+BF_N+1, smallSum.get());
+    std::copy(checkpoint->Read(1), checkpoint->Read(1)+SG_N+1, sum2.get());
+  } else {
+    CalculateSmallSums(f, threads);
+    std::copy(smallSum.get(), smallSum.get()+BF_N+1, checkpoint->Write(0));
+    checkpoint->Commit(SG_N, false);
+  }
+
+  CalculateLargeSums(gPrefixSum, rPrefixSum, checkpoint.get(), threads);
+  return true;
+}
+
+template <typename T>
+void MultiplicitiveSum2<T>::CalculateLargeSums(NtFunctionT<T> gPrefixSum,
+    NtFunctionT<T> rPrefixSum, SieveCheckpoint<T>* checkpoint, int threads) {
+  SieveProbe::Phase phase(&probe, "large sums");
   for (int i = 1; i <= SG_N; i++)
     sum1[i] = CalculateIndex(gPrefixSum, rPrefixSum, i);
 
-  for (int i = SG_N; i >= 1; i--)
+  // Indices i > iMax only need the small sums.
+  int start = checkpoint != nullptr ? checkpoint->GetProgress() : SG_N;
+  int iMax = std::min<llong>(SG_N, N/(BF_N+1));
+  if (cacheCallbacks) CacheCallbacks(gPrefixSum, rPrefixSum, iMax, threads);
+  for (int i = start; i > iMax; i--)
     sum2[i] = CalculateIndex(gPrefixSum, rPrefixSum, N/i);
+
+  // sum2[i] only depends on sum2[j] with j >= 2i, so all indices in (hi/2, hi]
+  // can be calculated together once the indices above hi are done.
+  for (int hi = std::min(start, iMax); hi >= 1; ) {
+    int lo = threads == 1 ? hi-1 : hi/2;
+    ParallelFor(lo+1, hi+1, threads,
+        [this, &gPrefixSum, &rPrefixSum](llong i, int) {
+      sum2[i] = CalculateIndex(gPrefixSum, rPrefixSum, N/i);
+    });
+    probe.Progress("large sums", SG_N-lo, SG_N);
+
+    if (checkpoint != nullptr && checkpoint->Due()) {
+      std::copy(sum2.get()+lo+1, sum2.get()+SG_N+1, checkpoint->Write(1)+lo+1);
+      checkpoint->Commit(lo, false);
+    }
+    hi = lo;
+  }
+
+  if (checkpoint != nullptr && !checkpoint->IsFinished()) {
+    std::copy(sum2.get(), sum2.get()+SG_N+1, checkpoint->Write(1));
+    checkpoint->Commit(0, true);
+  }
+}
+
+template <typename T>
+void MultiplicitiveSum2<T>::CacheCallbacks(NtFunctionT<T> gPrefixSum,
+    NtFunctionT<T> rPrefixSum, int iMax, int threads) {
+  SieveProbe::Phase phase(&probe, "callback cache");
+  gSmall.resize(SG_N+1);
+  gLarge.resize(SG_N+1);
+  rLarge.resize(iMax+1);
+
+  // Hands out the indices in chunks, as a single call can be cheap.
+  const llong chunk = 1<<10;
+  ParallelFor(0, SG_N/chunk+1, threads,
+      [this, &gPrefixSum, &rPrefixSum, iMax, chunk](llong c, int) {
+    for (llong k = c*chunk; k <= SG_N && k < (c+1)*chunk; k++) {
+      gSmall[k] = gPrefixSum(k);
+      if (k >= 1) gLarge[k] = gPrefixSum(N/k);
+      if (k >= 1 && k <= iMax) rLarge[k] = rPrefixSum(N/k);
+    }
+  });
+  probe.Count(kCallbackCalls, 2*SG_N+1+iMax);
 }
 
 template <typename T>
@@ -112,19 +371,73 @@ T MultiplicitiveSum2<T>::CalculateIndex(
     NtFunctionT<T> gPrefixSum, NtFunctionT<T> rPrefixSum, llong m) const {
   if (m <= BF_N) return smallSum[m];
 
-  DivisionEnumerator de;
-  T res = rPrefixSum(m);
+  DivisionBlockIterator it(m);
+  llong coef[kDivisionBlockBatch], begin[kDivisionBlockBatch],
+      end[kDivisionBlockBatch];
+  llong blocks = 0;
 
-  de.Do(m, [this, &res, &rPrefixSum, &gPrefixSum]
-      (llong coef, llong begin, llong end) {
-    T coefSum = gPrefixSum(end) - gPrefixSum(begin);
-    T fSum = GetPrefixSum(coef);
-    res -= coefSum * fSum;
-  });
+  if (cacheCallbacks) {
+    T res = rLarge[N/m];
+    for (int c; (c = it.Next(coef, begin, end, kDivisionBlockBatch)) > 0;) {
+      for (int i = 0; i < c; i++)
+        res -= (gCached(end[i]) - gCached(begin[i])) * GetPrefixSum(coef[i]);
+      blocks += c;
+    }
+    probe.Count(kQuotientUpdates, blocks);
+    return res;
+  }
 
+  T res = rPrefixSum(m);
+  for (int c; (c = it.Next(coef, begin, end, kDivisionBlockBatch)) > 0; ) {
+    for (int i = 0; i < c; i++) {
+      T coefSum = gPrefixSum(end[i]) - gPrefixSum(begin[i]);
+      T fSum = GetPrefixSum(coef[i]);
+      res -= coefSum * fSum;
+    }
+    blocks += c;
+  }
+
+  probe.Count(kCallbackCalls, 2*blocks+1);
+  probe.Count(kQuotientUpdates, blocks);
   return res;
 }
 
+// Read-only view of the tables finished by MultiplicitiveSum2::Calculate with
+// a checkpoint file. Queries are answered directly from the mapped file.
+template <typename T>
+class MappedMultiplicitiveSum2 {
+ public:
+  // Returns nullptr if the file does not hold finished tables.
+  static std::unique_ptr<MappedMultiplicitiveSum2<T>> Open(
+      const std::string& path) {
+    auto checkpoint = SieveCheckpoint<T>::OpenReadOnly(
+        path, kMultiplicitiveSum2Checkpoint);
+    if (checkpoint == nullptr) return nullptr;
+    return std::unique_ptr<MappedMultiplicitiveSum2<T>>(
+        new MappedMultiplicitiveSum2<T>(std::move(checkpoint)));
+  }
+
+  llong GetN() const { return N; }
+
+  // Gets the prefix sum of index m, where floor(N/m') = m for some m'.
+  T GetPrefixSum(llong m) const { return m <= BF_N ? smallSum[m] : sum2[N/m]; }
+
+ private:
+  MappedMultiplicitiveSum2(std::unique_ptr<SieveCheckpoint<T>> checkpoint_)
+      : checkpoint(std::move(checkpoint_)) {
+    N = checkpoint->GetN();
+    BF_N = checkpoint->GetSectionSize(0)-1;
+    smallSum = checkpoint->Read(0);
+    sum2 = checkpoint->Read(1);
+  }
+
+  std::unique_ptr<SieveCheckpoint<T>> checkpoint;
+  llong N;
+  llong BF_N;
+  const T* smallSum;
+  const T* sum2;
+};
+
 }  // namespace algo
 
 #endif  // ALGO_MULTIPLICITIVE_SUM2_H_
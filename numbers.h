@@ -1,12 +1,18 @@
 #ifndef ALGO_NUMBERS_H_
 #define ALGO_NUMBERS_H_
 
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "defs.h"
+#include "factorial_cache.h"
+#include "mod_num.h"
 #include "modular.h"
+#include "polynomial.h"
 
 namespace algo {
 
@@ -15,32 +21,30 @@ class Numbers {
  public:
   // Parameters:
   // - n: the max order to be processed
+  //
+  // Inverses, factorials and binomials come from the shared FactorialCache,
+  // so they are valid for any argument, and n only sizes the Bernoulli
+  // numbers. The cache is reserved up to n+1 here.
   Numbers(int n_) : Numbers(n_, false) {}
   Numbers(int n_, bool bernoulli_);
 
-  T inv(int k) const { return inversion[k]; }
+  T inv(int k) const { return cache.Inverse(k); }
   // B_plus(k) = (-1)^k * B_minus(k)
   T B_plus(int k) const { return b_plus[k]; }
-  T C(int n, int k) const {
-    if (n < 0 || k < 0 || n < k) return T(0);
-    if (k == 0 || n == k) return T(1);
-    return factors[n] * factors_inv[k] * factors_inv[n-k];
-  }
+  T C(int n, int k) const { return cache.C(n, k); }
 
   // Get \sum_{i=1}^n i^k mod P, where p is the prime in constructor
   T PrefixSum(llong n, int k) const;
+  // Get \sum_{i=1}^n i^k for all 0 <= k <= K at once, in O(K log K).
+  // K must not exceed the max order in constructor.
+  std::vector<T> PrefixSums(llong n, int K) const;
   // Get the coefficient of the term "n^k" in the expression \sum_{i=1}^n i^m
   T PrefixSumCoef(int m, int k) const;
 
  private:
-  void GetInverse();
-  void GetFactors();
-  void GetFactorsInverse();
   void GetBernoulliPlus();
 
-  std::unique_ptr<T[]> inversion;
-  std::unique_ptr<T[]> factors;
-  std::unique_ptr<T[]> factors_inv;
+  FactorialCache<T>& cache;
   std::unique_ptr<T[]> b_plus;
 
   int n;
@@ -49,51 +53,25 @@ class Numbers {
 
 template<typename T>
 Numbers<T>::Numbers(int n_, bool bernoulli_)
-    : n(n_), bernoulli(bernoulli_) {
-  GetInverse();
-  GetFactors();
-  GetFactorsInverse();
+    : cache(FactorialCache<T>::Instance()), n(n_), bernoulli(bernoulli_) {
+  cache.Reserve(n+1);
   if (bernoulli) {
     GetBernoulliPlus();
   }
 }
 
-template<typename T>
-void Numbers<T>::GetInverse() {
-  inversion = std::make_unique<T[]>(n+2);
-  inversion[0] = T(0);
-  inversion[1] = T(1);
-  for (int i = 2; i <= n+1; i++)
-    //inversion[i] = 1LL*(modp-modp/i)*inverse[modp%i]%modp;
-    inversion[i] = 1/T(i);
-}
-
-template<typename T>
-void Numbers<T>::GetFactors() {
-  factors = std::make_unique<T[]>(n+2);
-  factors[0] = T(1);
-  for (int i = 1; i <= n+1; i++)
-    factors[i] = i*factors[i-1];
-}
-
-template<typename T>
-void Numbers<T>::GetFactorsInverse() {
-  factors_inv = std::make_unique<T[]>(n+2);
-  factors_inv[0] = T(1);
-  for (int i = 1; i <= n+1; i++)
-    factors_inv[i] = inversion[i]*factors_inv[i-1];
-}
-
+// x/(e^x-1) = \sum_k B_minus(k) x^k/k!, so the Bernoulli numbers are the
+// power series inverse of (e^x-1)/x = \sum_k x^k/(k+1)!. That takes
+// O(n log n) with fast multiplication (see polynomial.h).
 template<typename T>
 void Numbers<T>::GetBernoulliPlus() {
+  std::vector<T> a(n+1);
+  for (int k = 0; k <= n; k++) a[k] = cache.FactorialInverse(k+1);
+  std::vector<T> inv = PolyInverse(a, n+1);
+
   b_plus = std::make_unique<T[]>(n+1);
-  b_plus[0] = 1;
-  for (int i = 1; i <= n; i++) {
-    T b = 0;
-    for (int j = 0; j < i; j++)
-      b += C(i+1, j)*b_plus[j];
-    b_plus[i] = 1 - b*inversion[i+1];
-  }
+  for (int k = 0; k <= n; k++)
+    b_plus[k] = (k%2 == 1 ? -inv[k] : inv[k]) * cache.Factorial(k);
 }
 
 template<typename T>
@@ -108,12 +86,204 @@ T Numbers<T>::PrefixSum(llong n, int k) const {
   return r;
 }
 
+// \sum_k (\sum_{i=1}^n i^k) x^k/k! = \sum_{i=1}^n e^{ix}
+//                              = (e^{nx}-1)/x * x/(1-e^{-x}),
+// where x/(1-e^{-x}) = \sum_k B_plus(k) x^k/k!, and
+// (e^{nx}-1)/x = \sum_k n^{k+1} x^k/(k+1)!. One multiplication gives all k.
+template<typename T>
+std::vector<T> Numbers<T>::PrefixSums(llong n, int K) const {
+  assert(bernoulli && K <= this->n);
+
+  std::vector<T> a(K+1), b(K+1);
+  T pn = T(n);
+  for (int k = 0; k <= K; k++) {
+    a[k] = pn*cache.FactorialInverse(k+1);
+    b[k] = b_plus[k]*cache.FactorialInverse(k);
+    pn *= T(n);
+  }
+  std::vector<T> res = PolyMultiply(a, b);
+  res.resize(K+1);
+  for (int k = 0; k <= K; k++) res[k] *= cache.Factorial(k);
+  return res;
+}
+
 template<typename T>
 T Numbers<T>::PrefixSumCoef(int m, int k) const {
   assert(bernoulli);
 
   if (k <= 0) return T(0);
-  return C(m+1, k)*B_plus(m+1-k)*inversion[m+1];
+  return C(m+1, k)*B_plus(m+1-k)*inv(m+1);
+}
+
+// Evaluates S(n) = \sum_{i=1}^n i^k for a fixed k and many n.
+//
+// S is a polynomial of degree k+1, so it is given by its values at
+// 0, 1, ..., k+1, and evaluated by Lagrange interpolation at those points.
+// The weights of the points are precomputed, and the products \prod (n-j)
+// with one factor left out come from prefix and suffix products, so a query
+// costs O(k) multiplications and no division. T must be a field whose
+// characteristic exceeds k+1.
+template <typename T>
+class PowerSumEvaluator {
+ public:
+  PowerSumEvaluator(int k_);
+
+  // Gets \sum_{i=1}^n i^k.
+  T Get(llong n) const;
+
+  // Gets \sum_{i=1}^n i^k for all n in ns. The queries are processed in
+  // tiles, so the inner loops run over independent queries.
+  std::vector<T> Get(const std::vector<llong>& ns) const;
+
+ private:
+  static const int kTile = 16;
+
+  void getTiles(const std::vector<llong>& ns, std::vector<T>& res,
+                std::false_type) const;
+  void getTiles(const std::vector<llong>& ns, std::vector<T>& res,
+                std::true_type) const;
+
+  int k;
+  // Number of points minus 1, i.e. d = k+1.
+  int d;
+  // y[i] = S(i) for 0 <= i <= d.
+  std::vector<T> y;
+  // w[i] = y[i] / \prod_{j != i} (i-j)
+  std::vector<T> w;
+};
+
+template <typename T>
+PowerSumEvaluator<T>::PowerSumEvaluator(int k_) : k(k_), d(k_+1) {
+  // i^k is completely multiplicative, so only primes need a power.
+  std::vector<T> pw(d+1, T(0));
+  std::vector<int> primes;
+  std::vector<bool> composite(d+1, false);
+  pw[1] = T(1);
+  for (int i = 2; i <= d; i++) {
+    if (!composite[i]) {
+      primes.push_back(i);
+      pw[i] = powR(T(i), k);
+    }
+    for (int p : primes) {
+      if (1LL*i*p > d) break;
+      composite[i*p] = true;
+      pw[i*p] = pw[i]*pw[p];
+      if (i%p == 0) break;
+    }
+  }
+
+  y = std::vector<T>(d+1, T(0));
+  for (int i = 1; i <= d; i++) y[i] = y[i-1] + pw[i];
+
+  // \prod_{j != i} (i-j) = i! * (d-i)! * (-1)^(d-i)
+  FactorialCache<T>& cache = FactorialCache<T>::Instance();
+  cache.Reserve(d);
+  w = std::vector<T>(d+1);
+  for (int i = 0; i <= d; i++) {
+    w[i] = y[i]*cache.FactorialInverse(i)*cache.FactorialInverse(d-i);
+    if ((d-i)%2 == 1) w[i] = -w[i];
+  }
+}
+
+template <typename T>
+T PowerSumEvaluator<T>::Get(llong n) const {
+  if (0 <= n && n <= d) return y[n];
+
+  // suf[i] = \prod_{j > i} (n-j)
+  thread_local std::vector<T> suf;
+  suf.resize(d+2);
+  const T x = T(n);
+  suf[d] = T(1);
+  for (int i = d; i > 0; i--) suf[i-1] = suf[i]*(x-T(i));
+
+  T res = T(0), pre = T(1);
+  for (int i = 0; i <= d; i++) {
+    res += w[i]*pre*suf[i];
+    pre *= x-T(i);
+  }
+  return res;
+}
+
+template <typename T>
+std::vector<T> PowerSumEvaluator<T>::Get(const std::vector<llong>& ns) const {
+  std::vector<T> res(ns.size());
+  getTiles(ns, res, std::integral_constant<bool, ModularTraits<T>::kModular>());
+  const int count = ns.size();
+  for (int i = 0; i < count; i++)
+    if (0 <= ns[i] && ns[i] <= d) res[i] = y[ns[i]];
+  return res;
+}
+
+template <typename T>
+void PowerSumEvaluator<T>::getTiles(const std::vector<llong>& ns,
+                                    std::vector<T>& res,
+                                    std::false_type) const {
+  // suf[i*kTile+t] = \prod_{j > i} (x[t]-j) for the queries in the tile.
+  std::vector<T> suf((d+1)*kTile);
+  T x[kTile], pre[kTile], sum[kTile];
+
+  const int count = ns.size();
+  for (int base = 0; base < count; base += kTile) {
+    const int len = std::min<int>(kTile, count-base);
+    for (int t = 0; t < len; t++) {
+      x[t] = T(ns[base+t]);
+      pre[t] = T(1);
+      sum[t] = T(0);
+      suf[d*kTile+t] = T(1);
+    }
+    for (int i = d; i > 0; i--) {
+      const T c = T(i);
+      for (int t = 0; t < len; t++)
+        suf[(i-1)*kTile+t] = suf[i*kTile+t]*(x[t]-c);
+    }
+    for (int i = 0; i <= d; i++) {
+      const T c = T(i);
+      for (int t = 0; t < len; t++) {
+        sum[t] += w[i]*pre[t]*suf[i*kTile+t];
+        pre[t] *= x[t]-c;
+      }
+    }
+    for (int t = 0; t < len; t++) res[base+t] = sum[t];
+  }
+}
+
+// Same as above on plain residues. The modulus is a compile time constant,
+// so the reductions are multiplications, and the loops over a tile have no
+// branches.
+template <typename T>
+void PowerSumEvaluator<T>::getTiles(const std::vector<llong>& ns,
+                                    std::vector<T>& res,
+                                    std::true_type) const {
+  typedef ModularTraits<T> Traits;
+  const ullong p = Traits::kModulus;
+  std::vector<ullong> suf((d+1)*kTile), wr(d+1);
+  for (int i = 0; i <= d; i++) wr[i] = Traits::ToResidue(w[i]);
+  ullong x[kTile], pre[kTile], sum[kTile];
+
+  const int count = ns.size();
+  for (int base = 0; base < count; base += kTile) {
+    const int len = std::min<int>(kTile, count-base);
+    for (int t = 0; t < len; t++) {
+      // x[t]+p-c < 2p for all 0 <= c <= d < p.
+      x[t] = Traits::ToResidue(T(ns[base+t])) + p;
+      pre[t] = 1;
+      sum[t] = 0;
+      suf[d*kTile+t] = 1;
+    }
+    for (int i = d; i > 0; i--) {
+      const ullong* s = &suf[i*kTile];
+      ullong* r = &suf[(i-1)*kTile];
+      for (int t = 0; t < len; t++) r[t] = s[t]*(x[t]-i)%p;
+    }
+    for (int i = 0; i <= d; i++) {
+      const ullong* s = &suf[i*kTile];
+      for (int t = 0; t < len; t++) {
+        sum[t] = (sum[t] + wr[i]*pre[t]%p*s[t])%p;
+        pre[t] = pre[t]*(x[t]-i)%p;
+      }
+    }
+    for (int t = 0; t < len; t++) res[base+t] = Traits::FromResidue(sum[t]);
+  }
 }
 
 }  // namespace algo
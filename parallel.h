@@ -0,0 +1,151 @@
+#ifndef ALGO_PARALLEL_H_
+#define ALGO_PARALLEL_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "defs.h"
+
+namespace algo {
+
+// Gets the number of threads to use when the caller asks for threads <= 0.
+int DefaultThreadCount() {
+  int n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+// Calls fn(i, worker) for every i in [begin, end) on given number of threads
+// (all cores if threads <= 0). Indices are handed out one at a time in
+// increasing order, so that items with uneven costs are balanced.
+void ParallelFor(llong begin, llong end, int threads,
+                 std::function<void(llong, int)> fn) {
+  if (threads <= 0) threads = DefaultThreadCount();
+  if (threads == 1 || end-begin <= 1) {
+    for (llong i = begin; i < end; i++) fn(i, 0);
+    return;
+  }
+
+  std::atomic<llong> next(begin);
+  auto work = [&next, end, &fn](int w) {
+    for (llong i = next++; i < end; i = next++) fn(i, w);
+  };
+  std::vector<std::thread> pool;
+  for (int w = 1; w < threads; w++) pool.emplace_back(work, w);
+  work(0);
+  for (auto& t : pool) t.join();
+}
+
+// Runs tasks on a fixed number of workers with work stealing.
+//
+// Each worker owns a deque of tasks. It takes tasks from the back of its own
+// deque, so it walks its part of the work depth-first and the deque stays
+// small. An idle worker steals from the front of the others' deques, which
+// hands out the oldest (and for tree shaped work, the largest) pending tasks.
+template <typename Task>
+class WorkStealingPool {
+ public:
+  typedef std::function<void(const Task&)> PushFunction;
+  // process(task, worker, push) handles one task on given worker.
+  // Calling push(task) schedules a new task on the same worker.
+  typedef std::function<void(const Task&, int, const PushFunction&)>
+      ProcessFunction;
+
+  WorkStealingPool(int threads_)
+      : threads(threads_ > 0 ? threads_ : DefaultThreadCount()) {}
+
+  int GetThreads() const { return threads; }
+
+  // Processes the given tasks, and all tasks pushed while processing them.
+  // Returns after all of them are done.
+  void Run(const std::vector<Task>& tasks, ProcessFunction process);
+
+ private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  void push(int w, const Task& task);
+  bool pop(int w, Task* task);
+  bool steal(int w, Task* task);
+  void work(int w, const ProcessFunction& process);
+
+  int threads;
+  std::vector<std::unique_ptr<Worker>> workers;
+  // Number of tasks pushed but not finished yet.
+  std::atomic<llong> pending;
+};
+
+template <typename Task>
+void WorkStealingPool<Task>::Run(const std::vector<Task>& tasks,
+                                 ProcessFunction process) {
+  workers.clear();
+  for (int i = 0; i < threads; i++)
+    workers.push_back(std::make_unique<Worker>());
+
+  const int count = tasks.size();
+  pending = count;
+  for (int i = 0; i < count; i++)
+    workers[i%threads]->tasks.push_back(tasks[i]);
+
+  std::vector<std::thread> pool;
+  for (int i = 1; i < threads; i++)
+    pool.emplace_back([this, i, &process] { work(i, process); });
+  work(0, process);
+  for (auto& t : pool) t.join();
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::push(int w, const Task& task) {
+  // Counts the task before the parent finishes, so pending never drops to
+  // zero while there is still work.
+  pending++;
+  std::lock_guard<std::mutex> guard(workers[w]->lock);
+  workers[w]->tasks.push_back(task);
+}
+
+template <typename Task>
+bool WorkStealingPool<Task>::pop(int w, Task* task) {
+  std::lock_guard<std::mutex> guard(workers[w]->lock);
+  if (workers[w]->tasks.empty()) return false;
+  *task = workers[w]->tasks.back();
+  workers[w]->tasks.pop_back();
+  return true;
+}
+
+template <typename Task>
+bool WorkStealingPool<Task>::steal(int w, Task* task) {
+  for (int i = 1; i < threads; i++) {
+    Worker& victim = *workers[(w+i)%threads];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (victim.tasks.empty()) continue;
+    *task = victim.tasks.front();
+    victim.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::work(int w, const ProcessFunction& process) {
+  PushFunction push_fn = [this, w](const Task& task) { push(w, task); };
+
+  Task task;
+  while (pending > 0) {
+    if (!pop(w, &task) && !steal(w, &task)) {
+      std::this_thread::yield();
+      continue;
+    }
+    process(task, w, push_fn);
+    pending--;
+  }
+}
+
+}  // namespace algo
+
+#endif  // ALGO_PARALLEL_H_
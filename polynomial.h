@@ -0,0 +1,168 @@
+#ifndef ALGO_POLYNOMIAL_H_
+#define ALGO_POLYNOMIAL_H_
+
+#include <algorithm>
+#include <cassert>
+#include <type_traits>
+#include <vector>
+
+#include "defs.h"
+#include "fft.h"
+#include "mod_num.h"
+
+namespace algo {
+
+// Polynomials are vectors of coefficients, lower degrees first.
+
+namespace {
+
+// Below this size schoolbook multiplication is faster than FFT.
+const int kPolyFftThreshold = 64;
+
+template <typename T>
+void PolyMultiplySchoolbook(const std::vector<T>& a, const std::vector<T>& b,
+                            std::vector<T>& res) {
+  const int n = a.size(), m = b.size();
+  res.assign(n+m-1, T(0));
+  for (int i = 0; i < n; i++) {
+    if (a[i] == T(0)) continue;
+    for (int j = 0; j < m; j++) res[i+j] += a[i]*b[j];
+  }
+}
+
+template <typename T>
+void PolyMultiplyInternal(const std::vector<T>& a, const std::vector<T>& b,
+                          std::vector<T>& res, std::false_type) {
+  PolyMultiplySchoolbook(a, b, res);
+}
+
+// Modular types go through fft_modulo on their residues.
+template <typename T>
+void PolyMultiplyInternal(const std::vector<T>& a, const std::vector<T>& b,
+                          std::vector<T>& res, std::true_type) {
+  typedef ModularTraits<T> Traits;
+  const int n = a.size(), m = b.size();
+  if (std::min(n, m) < kPolyFftThreshold) {
+    PolyMultiplySchoolbook(a, b, res);
+    return;
+  }
+
+  std::vector<int> pa(n), pb(m);
+  for (int i = 0; i < n; i++) pa[i] = Traits::ToResidue(a[i]);
+  for (int i = 0; i < m; i++) pb[i] = Traits::ToResidue(b[i]);
+  std::vector<int> pr = fft_modulo(pa, pb, Traits::kModulus);
+
+  res.resize(n+m-1);
+  for (int i = 0; i < n+m-1; i++) res[i] = Traits::FromResidue(pr[i]);
+}
+
+}  // namespace
+
+// res = a*b. res must not be a or b.
+template <typename T>
+void PolyMultiply(const std::vector<T>& a, const std::vector<T>& b,
+                  std::vector<T>& res) {
+  if (a.empty() || b.empty()) {
+    res.clear();
+    return;
+  }
+  PolyMultiplyInternal(a, b, res,
+      std::integral_constant<bool, ModularTraits<T>::kModular>());
+}
+
+template <typename T>
+std::vector<T> PolyMultiply(const std::vector<T>& a, const std::vector<T>& b) {
+  std::vector<T> res;
+  PolyMultiply(a, b, res);
+  return res;
+}
+
+// Gets the first n coefficients of 1/a. a[0] must be invertible.
+//
+// Newton's iteration doubles the number of correct coefficients with
+// b = b*(2 - a*b), so it costs a constant number of multiplications of size n.
+template <typename T>
+std::vector<T> PolyInverse(const std::vector<T>& a, int n) {
+  assert(!a.empty());
+  std::vector<T> b(1, T(1)/a[0]), head, ab, t;
+  for (int len = 1; len < n; ) {
+    len = std::min(2*len, n);
+    head.assign(a.begin(), a.begin()+std::min<int>(a.size(), len));
+    PolyMultiply(head, b, ab);
+    ab.resize(len);
+    for (T& x : ab) x = -x;
+    ab[0] += T(2);
+    PolyMultiply(b, ab, t);
+    t.resize(len);
+    b.swap(t);
+  }
+  b.resize(n);
+  return b;
+}
+
+// Reduces polynomials modulo a fixed monic polynomial m of degree d, with
+// two multiplications each (Newton division):
+//   q = rev(rev(a) / rev(m)), a mod m = a - q*m.
+// The inverse of rev(m) is calculated once, and all buffers are kept between
+// calls.
+template <typename T>
+class PolyModulus {
+ public:
+  // m must be monic, i.e. m.back() == 1. Reduce accepts polynomials with at
+  // most max_size coefficients (2*d by default).
+  PolyModulus(const std::vector<T>& m_, int max_size = -1);
+
+  int GetDegree() const { return d; }
+
+  // a = a mod m, with exactly d coefficients.
+  void Reduce(std::vector<T>& a);
+
+ private:
+  std::vector<T> m;
+  int d;
+  // The first max_size-d coefficients of 1/rev(m).
+  std::vector<T> inv;
+  // Buffers.
+  std::vector<T> rev;
+  std::vector<T> head;
+  std::vector<T> q;
+  std::vector<T> qm;
+};
+
+template <typename T>
+PolyModulus<T>::PolyModulus(const std::vector<T>& m_, int max_size)
+    : m(m_), d(m_.size()-1) {
+  assert(d >= 1 && m.back() == T(1));
+  if (max_size < 0) max_size = 2*d;
+
+  std::vector<T> mr(m.rbegin(), m.rend());
+  inv = PolyInverse(mr, std::max(1, max_size-d));
+  // Only the lower part of m matters for the remainder.
+  m.pop_back();
+}
+
+template <typename T>
+void PolyModulus<T>::Reduce(std::vector<T>& a) {
+  if (int(a.size()) <= d) {
+    a.resize(d, T(0));
+    return;
+  }
+  const int len = a.size()-d;
+  assert(len <= int(inv.size()));
+
+  rev.assign(a.rbegin(), a.rbegin()+len);
+  head.assign(inv.begin(), inv.begin()+len);
+  PolyMultiply(rev, head, q);
+  q.resize(len);
+  std::reverse(q.begin(), q.end());
+
+  // a - q*(x^d + m') = a - q*m' in the lower d coefficients.
+  PolyMultiply(q, m, qm);
+  a.resize(d);
+  const int count = std::min<int>(d, qm.size());
+  for (int i = 0; i < count; i++) a[i] -= qm[i];
+}
+
+}  // namespace algo
+
+#endif  // ALGO_POLYNOMIAL_H_
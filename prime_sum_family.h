@@ -7,6 +7,10 @@
 #include <vector>
 
 #include "defs.h"
+#include "gcd.h"
+#include "multiplicitive_prime_sum.h"
+#include "parallel.h"
+#include "sieve_probe.h"
 
 namespace algo {
 
@@ -29,21 +33,30 @@ class PrimeSumFamily {
   T GetSum(int a, llong k) const {
     int id = p2id[a];
     assert(id >= 0);
-    return k <= SG_N ? sum[k][id] : sum2[N/k][id];
+    return row(k)[id];
   }
 
- private:
-  void update(std::vector<T>& sumv, llong index, int pIndex) {
-    llong p = primes[pIndex];
+  // Reports phase timings and progress to listener. Only works when compiled
+  // with ALGO_INSTRUMENTATION, see sieve_probe.h.
+  void SetListener(SieveListener* listener, double interval = 1.0) {
+    probe.SetListener(listener, interval);
+  }
+  SieveStats GetStats() const { return probe.GetStats(); }
 
-    std::vector<T> psum(id2p.size(), T(0));
-    for (int i = 0; i < id2p.size(); i++)
-      psum[i] = GetSum(id2p[i], index/p) - GetSum(id2p[i], p-1);
+ private:
+  // The sums of all residues at index k: row(k)[id] is for residue id2p[id].
+  const T* row(llong k) const {
+    return k <= SG_N ? &sum[k*K] : &sum2[N/k*K];
+  }
 
-    for (int a : id2p) {
-      int prev = p2id[a], cur = p2id[a*p%M];
-      sumv[cur] -= psum[prev] * fp[pIndex];
-    }
+  // Removes the numbers with smallest prime factor primes[pIndex] from the
+  // sums at index. The rows read are never the one written.
+  void update(T* sumv, llong index, int pIndex) {
+    llong p = primes[pIndex];
+    const T* high = row(index/p);
+    const T* low = row(p-1);
+    const T f = fp[pIndex];
+    for (int i = 0; i < K; i++) sumv[target[i]] -= (high[i] - low[i]) * f;
   }
 
   llong N;
@@ -51,21 +64,28 @@ class PrimeSumFamily {
   int SG_N;
   // Sums over Z/Zm field
   int M;
+  // Number of residues co-prime to M.
+  int K;
 
   std::vector<int> primes;
 
   // fp[i] is the f value for primes[i]. caching for better preformance
   std::vector<T> fp;
 
-  // sum[i][k] is the prefix sums of k-th number in id2p
-  std::vector<std::vector<T>> sum;
-  std::vector<std::vector<T>> sum2;
+  // The sums are stored row by row: sum[k*K+id] is the prefix sum to k of
+  // the residue id2p[id], and sum2[k*K+id] the one to N/k.
+  std::vector<T> sum;
+  std::vector<T> sum2;
 
   // mappings
   // id of the co-prime number to co-prime number.
   std::vector<int> id2p;
   // co-prime number to its id. Only defined in number coprime to m.
   std::vector<int> p2id;
+  // target[id] = p2id[id2p[id]*p%M] for the prime p being sieved.
+  std::vector<int> target;
+
+  SieveProbe probe;
 };
 
 template <typename T>
@@ -80,42 +100,269 @@ PrimeSumFamily<T>::PrimeSumFamily(llong n, int m) : N(n), M(m) {
 
   p2id = std::vector<int>(M, -1);
   for (int i = 0; i < M; i++) {
-    if (std::__gcd(i, M) != 1) continue;
+    if (BinaryGcd(i, M) != 1) continue;
     int id = id2p.size();
     id2p.push_back(i);
     p2id[i] = id;
   }
+  K = id2p.size();
 
   fp = std::vector<T>(primes.size());
-  sum = std::vector<std::vector<T>>(SG_N+1, std::vector<T>(id2p.size(), T(0)));
-  sum2 = std::vector<std::vector<T>>(SG_N+1, std::vector<T>(id2p.size(), T(0)));
+  sum = std::vector<T>((SG_N+1LL)*K, T(0));
+  sum2 = std::vector<T>((SG_N+1LL)*K, T(0));
+  target = std::vector<int>(K);
 }
 
 template <typename T>
 void PrimeSumFamily<T>::GetSumOverPrimes(PartialSumFunctionT<T> mf_sum) {
-  for (int i = 0; i < primes.size(); i++) {
-    int p = primes[i];
-    if (std::__gcd(p, M) != 1) continue;
-    fp[i] = mf_sum(p, p%M) - mf_sum(p-1, p%M);
+  const int count = primes.size();
+  {
+    SieveProbe::Phase phase(&probe, "init");
+    llong calls = 0;
+    for (int i = 0; i < count; i++) {
+      int p = primes[i];
+      if (p2id[p%M] < 0) continue;
+      fp[i] = mf_sum(p, p%M) - mf_sum(p-1, p%M);
+      calls += 2;
+    }
+    for (int id = 0; id < K; id++) {
+      int a = id2p[id];
+      for (int i = 0; i <= SG_N; i++) sum[1LL*i*K+id] = mf_sum(i, a);
+      for (int i = 1; i <= SG_N; i++) sum2[1LL*i*K+id] = mf_sum(N/i, a);
+      calls += 2*SG_N+1;
+    }
+    probe.Count(kCallbackCalls, calls);
+  }
+
+  SieveProbe::Phase phase(&probe, "sieve");
+  for (int pIndex = 0; pIndex < count; pIndex++) {
+    llong p = primes[pIndex];
+    if (p2id[p%M] < 0) continue;
+    for (int id = 0; id < K; id++) target[id] = p2id[id2p[id]*p%M];
+
+    llong minN = p*(p-1), updates = 0;
+    for (int j = 1; j <= SG_N && N/j > minN; j++, updates++)
+      update(&sum2[1LL*j*K], N/j, pIndex);
+    for (int j = SG_N; j >= 0 && j > minN; j--, updates++)
+      update(&sum[1LL*j*K], j, pIndex);
+    probe.Count(kQuotientUpdates, updates*K);
+    probe.Progress("sieve", pIndex+1, count);
   }
-  for (int a : id2p) {
+}
+
+// Same sums as PrimeSumFamily, calculated by diagonalising over the Dirichlet
+// characters mod M instead.
+//
+// For every character x, x(n)f(n) is completely multiplicitive as well, so its
+// sum over primes is a plain MultiplicitivePrimeSum. The sum over residue a is
+// then (1/K) \sum_x conj(x(a)) (\sum_p x(p)f(p)), where K = phi(M). Each of the
+// K runs is as fast as a single prime sum and they are independent, so they
+// run in parallel.
+//
+// The characters take values in T, which must hold a root of unity whose
+// order is the exponent of (Z/MZ)*, e.g. a ModNum<P> where GetExponent(M)
+// divides P-1.
+template <typename T>
+class PrimeSumFamilyByCharacters {
+ public:
+  // root: a primitive GetExponent(m)-th root of unity in T.
+  PrimeSumFamilyByCharacters(llong n, int m, T root);
+
+  // Gets the exponent of (Z/mZ)*, i.e. the Carmichael function of m.
+  static int GetExponent(int m);
+
+  // Same as PrimeSumFamily::GetSumOverPrimes, with the characters processed
+  // on given number of threads (all cores if threads <= 0).
+  void GetSumOverPrimes(PartialSumFunctionT<T> mf_sum, int threads = 1);
+
+  // Gets the \sum{ f(p) : 0 < p <= k, p is a prime and p = a (mod M) }.
+  // only works for 0 <= a < M and gcd(a, M) = 1
+  T GetSum(int a, llong k) const {
     int id = p2id[a];
-    for (int i = 0; i <= SG_N; i++) sum[i][id] = mf_sum(i, a);
-    for (int i = 1; i <= SG_N; i++) sum2[i][id] = mf_sum(N/i, a);
+    assert(id >= 0);
+    return k <= SG_N ? sum[k*K+id] : sum2[N/k*K+id];
   }
 
-  for (int pIndex = 0; pIndex < primes.size(); pIndex++) {
-    llong p = primes[pIndex];
-    if (std::__gcd<int>(p, M) != 1) continue;
+  // Reports phase timings to listener. Only works when compiled with
+  // ALGO_INSTRUMENTATION, see sieve_probe.h.
+  void SetListener(SieveListener* listener, double interval = 1.0) {
+    probe.SetListener(listener, interval);
+  }
+  SieveStats GetStats() const { return probe.GetStats(); }
+
+ private:
+  // Transforms every row of K values between residues and characters, i.e.
+  // row[x] = \sum_a x(a)^sign row[a] in place.
+  void transform(std::vector<T>& table, int sign) const;
+
+  llong N;
+  // SG_N = floor(N^{1/2})
+  int SG_N;
+  int M;
+  // phi(M), the number of residues and of characters.
+  int K;
 
-    llong minN = p*(p-1);
-    for (int j = 1; j <= SG_N && N/j > minN; j++)
-      update(sum2[j], N/j, pIndex);
-    for (int j = SG_N; j >= 0 && j > minN; j--)
-      update(sum[j], j, pIndex);
+  // (Z/MZ)* is the direct product of cyclic groups generated by gens[i] of
+  // order orders[i]. The residue with id = \sum_i e_i*strides[i] is
+  // \prod_i gens[i]^e_i, and the character with id = \sum_i c_i*strides[i]
+  // maps gens[i] to w^(c_i*lambda/orders[i]).
+  std::vector<int> gens;
+  std::vector<int> orders;
+  std::vector<int> strides;
+  // The exponent of (Z/MZ)*, and w^i for 0 <= i < lambda.
+  int lambda;
+  std::vector<T> wpow;
+
+  // Residue of id, and id of residue (-1 if not co-prime to M).
+  std::vector<int> id2p;
+  std::vector<int> p2id;
+
+  // Same layout as in PrimeSumFamily.
+  std::vector<T> sum;
+  std::vector<T> sum2;
+
+  SieveProbe probe;
+};
+
+template <typename T>
+int PrimeSumFamilyByCharacters<T>::GetExponent(int m) {
+  int res = 1;
+  for (int p = 2; p <= m; p++) {
+    if (m%p != 0) continue;
+    int q = 1;
+    while (m%p == 0) m /= p, q *= p;
+    // (Z/2^e)* = <-1> x <5> has exponent 2^(e-2) for e >= 3.
+    int order = p == 2 ? (q >= 8 ? q/4 : q/2) : q/p*(p-1);
+    res = res/BinaryGcd(res, order)*order;
+  }
+  return res;
+}
+
+template <typename T>
+PrimeSumFamilyByCharacters<T>::PrimeSumFamilyByCharacters(
+    llong n, int m, T root) : N(n), M(m) {
+  SG_N = int(sqrt(n));
+
+  // Finds the cyclic factors of every prime power q || M, lifted to residues
+  // mod M which are 1 mod M/q.
+  auto lift = [m](int q, int x) {
+    for (int y = 1; ; y += m/q) if (y%q == x%q) return y;
+  };
+  int rest = m;
+  for (int p = 2; p <= rest; p++) {
+    if (rest%p != 0) continue;
+    int q = 1;
+    while (rest%p == 0) rest /= p, q *= p;
+    if (p == 2) {
+      if (q >= 4) gens.push_back(lift(q, q-1)), orders.push_back(2);
+      if (q >= 8) gens.push_back(lift(q, 5)), orders.push_back(q/4);
+      continue;
+    }
+    // Finds a primitive root of q by its order.
+    int phi = q/p*(p-1);
+    for (int g = 2; ; g++) {
+      if (g%p == 0) continue;
+      int order = 1;
+      for (llong x = g; x != 1; x = x*g%q) order++;
+      if (order == phi) {
+        gens.push_back(lift(q, g));
+        orders.push_back(phi);
+        break;
+      }
+    }
+  }
+
+  K = 1;
+  for (int order : orders) strides.push_back(K), K *= order;
+
+  // Walks all exponent vectors in the order of id.
+  id2p = std::vector<int>(K);
+  p2id = std::vector<int>(M, -1);
+  const int factors = gens.size();
+  for (int id = 0; id < K; id++) {
+    llong a = 1;
+    for (int i = 0; i < factors; i++)
+      for (int e = id/strides[i]%orders[i]; e > 0; e--) a = a*gens[i]%M;
+    id2p[id] = a%M;
+    p2id[a%M] = id;
+  }
+
+  lambda = GetExponent(M);
+  wpow = std::vector<T>(lambda);
+  wpow[0] = T(1);
+  for (int i = 1; i < lambda; i++) wpow[i] = wpow[i-1]*root;
+  assert(wpow[lambda-1]*root == T(1));
+}
+
+template <typename T>
+void PrimeSumFamilyByCharacters<T>::transform(std::vector<T>& table,
+                                              int sign) const {
+  std::vector<T> tmp;
+  const llong size = table.size();
+  const int factors = orders.size();
+  for (llong base = 0; base < size; base += K) {
+    T* v = &table[base];
+    // One DFT per cyclic factor.
+    for (int i = 0; i < factors; i++) {
+      int o = orders[i], s = strides[i], step = lambda/o;
+      tmp.resize(o);
+      for (int id = 0; id < K; id++) {
+        if (id/s%o != 0) continue;
+        for (int c = 0; c < o; c++) {
+          T x = T(0);
+          for (int e = 0; e < o; e++) {
+            int k = llong(c)*e%o*step;
+            x += v[id+e*s] * wpow[sign > 0 ? k : (lambda-k)%lambda];
+          }
+          tmp[c] = x;
+        }
+        for (int c = 0; c < o; c++) v[id+c*s] = tmp[c];
+      }
+    }
   }
 }
 
+template <typename T>
+void PrimeSumFamilyByCharacters<T>::GetSumOverPrimes(
+    PartialSumFunctionT<T> mf_sum, int threads) {
+  {
+    SieveProbe::Phase phase(&probe, "init");
+    sum = std::vector<T>((SG_N+1LL)*K);
+    sum2 = std::vector<T>((SG_N+1LL)*K);
+    for (int id = 0; id < K; id++) {
+      int a = id2p[id];
+      for (int i = 0; i <= SG_N; i++) sum[1LL*i*K+id] = mf_sum(i, a);
+      for (int i = 1; i <= SG_N; i++) sum2[1LL*i*K+id] = mf_sum(N/i, a);
+    }
+    probe.Count(kCallbackCalls, (2*SG_N+1LL)*K);
+    transform(sum, 1);
+    transform(sum2, 1);
+  }
+
+  {
+    // All arguments of mf_sum in MultiplicitivePrimeSum are either <= SG_N
+    // or N/i, so the transformed tables answer all of them.
+    SieveProbe::Phase phase(&probe, "sieve");
+    ParallelFor(0, K, threads, [this](llong x, int) {
+      auto chi_sum = [this, x](llong k) {
+        return k <= SG_N ? sum[k*K+x] : sum2[N/k*K+x];
+      };
+      MultiplicitivePrimeSum<T> mps(N);
+      mps.GetSumOverPrimes(chi_sum);
+      for (int i = 0; i <= SG_N; i++) sum[1LL*i*K+x] = mps.GetSum(i);
+      for (int i = 1; i <= SG_N; i++) sum2[1LL*i*K+x] = mps.GetSum(N/i);
+      probe.Merge(mps.GetStats());
+    });
+  }
+
+  SieveProbe::Phase phase(&probe, "inverse");
+  transform(sum, -1);
+  transform(sum2, -1);
+  const T k_inv = T(1)/T(K);
+  for (T& x : sum) x *= k_inv;
+  for (T& x : sum2) x *= k_inv;
+}
+
 }  // namespace algo
 
 #endif  // ALGO_PRIME_SUM_FAMILY_H_
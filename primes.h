@@ -2,11 +2,13 @@
 #define ALGO_PRIMES_H_
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 #include <cassert>
 
 #include "defs.h"
 #include "modular.h"
+#include "parallel.h"
 
 namespace algo {
 namespace {
@@ -24,8 +26,6 @@ int GetQuadraticNonresiduePrime(int p)
   return -1;
 }
 
-typedef __int128 i128;
-
 llong powK(llong a, llong b, llong p)
 {
   if (b == 0) return 1%p;
@@ -56,6 +56,89 @@ bool RmOnce(llong n, int a)
   return false;
 }
 
+// Numbers per segment of PrimeInfos, and the max number of distinct prime
+// factors of an int.
+const int kPrimeInfoSegment = 1<<18;
+const int kMaxDistinctFactors = 10;
+
+// Montgomery arithmetic modulo an odd p < 2^31, with R = 2^32. Products
+// are reduced by multiplications and a shift instead of a division.
+class Montgomery32 {
+ public:
+  Montgomery32(unsigned p_) : p(p_), r2((-ullong(p_)) % p_) {
+    // Newton's iteration for p^-1 mod 2^32, then negated.
+    unsigned inv = p;
+    for (int i = 0; i < 4; i++) inv *= 2-p*inv;
+    neg_inv = -inv;
+    one = reduce(r2);
+  }
+
+  unsigned To(unsigned a) const { return reduce(ullong(a)*r2); }
+  unsigned From(unsigned a) const { return reduce(a); }
+  unsigned One() const { return one; }
+  unsigned Multiply(unsigned a, unsigned b) const {
+    return reduce(ullong(a)*b);
+  }
+
+  // Gets a^e, with a and the result in Montgomery form.
+  unsigned Pow(unsigned a, ullong e) const {
+    unsigned res = one;
+    for (; e > 0; e >>= 1) {
+      if (e&1) res = Multiply(res, a);
+      a = Multiply(a, a);
+    }
+    return res;
+  }
+
+ private:
+  // t*R^-1 mod p, for t < p*2^32.
+  unsigned reduce(ullong t) const {
+    unsigned m = unsigned(t)*neg_inv;
+    unsigned res = (t + ullong(m)*p) >> 32;
+    return res >= p ? res-p : res;
+  }
+
+  unsigned p;
+  unsigned neg_inv;
+  unsigned r2;
+  unsigned one;
+};
+
+// Gets the Jacobi symbol (a/n) for odd n > 0, by quadratic reciprocity.
+int Jacobi(llong a, llong n)
+{
+  int res = 1;
+  a %= n;
+  if (a < 0) a += n;
+  while (a != 0) {
+    while (a%2 == 0) {
+      a /= 2;
+      if (n%8 == 3 || n%8 == 5) res = -res;
+    }
+    std::swap(a, n);
+    if (a%4 == 3 && n%4 == 3) res = -res;
+    a %= n;
+  }
+  return n == 1 ? res : 0;
+}
+
+// Cornacchia's algorithm for x^2 + y^2 = p: Euclid on (p, c) with
+// c^2 = -1 (mod p) stops at the first remainder below sqrt(p).
+PII CornacchiaPrime(int p, int c)
+{
+  llong a = p, b = c;
+  while (b*b > p) {
+    llong r = a%b;
+    a = b;
+    b = r;
+  }
+  llong x = llong(sqrtl(p-b*b));
+  while (x*x > p-b*b) x--;
+  while ((x+1)*(x+1) <= p-b*b) x++;
+  assert(x*x + b*b == p);
+  return PII(std::min<llong>(x, b), std::max<llong>(x, b));
+}
+
 }  // namespace
 
 // For given prime p, returns a pair of positive integers (a, b) which
@@ -90,6 +173,124 @@ bool RabinMiller(llong n)
   return true;
 }
 
+struct PrimeInfo {
+  int p;
+  // The smallest primitive root.
+  int root;
+  // A square root of -1, or -1 if there is none, i.e. p = 3 (mod 4).
+  int sqrt_minus_one;
+  // (a, b) with a^2 + b^2 = p and a <= b, or (-1, -1) if p = 3 (mod 4).
+  PII two_squares;
+};
+
+// Gets the PrimeInfo of every prime in [lo, hi], for hi < 2^31, in
+// increasing order, on given number of threads (all cores if threads <= 0).
+//
+// The range is sieved in segments, which are handed out to the threads. A
+// second pass over the multiples of the sieving primes collects the prime
+// factors below sqrt(hi) of every p-1 in the segment, so candidate roots g
+// are only checked with g^((p-1)/q) for the prime factors q, in Montgomery
+// form. The Jacobi symbol rules out all quadratic residues without a power.
+// Then sqrt(-1) = g^((p-1)/4), and Cornacchia's algorithm gives the two
+// squares.
+std::vector<PrimeInfo> GetPrimeInfos(int lo, int hi, int threads = 1)
+{
+  if (threads <= 0) threads = DefaultThreadCount();
+  lo = std::max(lo, 2);
+  if (lo > hi) return std::vector<PrimeInfo>();
+
+  int sq = int(sqrt(double(hi)));
+  while (1LL*sq*sq > hi) sq--;
+  while (1LL*(sq+1)*(sq+1) <= hi) sq++;
+  std::vector<int> base;
+  std::vector<bool> composite(sq+1, false);
+  for (int i = 2; i <= sq; i++) if (!composite[i]) {
+    base.push_back(i);
+    for (int j = i*i; j <= sq; j += i) composite[j] = true;
+  }
+
+  const llong segments = (1LL+hi-lo+kPrimeInfoSegment-1)/kPrimeInfoSegment;
+  std::vector<std::vector<PrimeInfo>> found(segments);
+  // Buffers of each worker: primality of [l, r), and the small prime
+  // factors of [l-1, r-1).
+  std::vector<std::vector<char>> is_prime(threads);
+  std::vector<std::vector<int>> factors(threads);
+  std::vector<std::vector<char>> counts(threads);
+
+  ParallelFor(0, segments, threads,
+      [lo, hi, &base, &found, &is_prime, &factors, &counts](
+          llong seg, int w) {
+    const llong l = lo+seg*kPrimeInfoSegment;
+    const llong r = std::min<llong>(hi+1LL, l+kPrimeInfoSegment);
+    const int len = r-l;
+    std::vector<char>& prime = is_prime[w];
+    std::vector<int>& fac = factors[w];
+    std::vector<char>& cnt = counts[w];
+    prime.assign(len, 1);
+    fac.resize(1LL*len*kMaxDistinctFactors);
+    cnt.assign(len, 0);
+    for (int q : base)
+      for (llong m = std::max(1LL*q*q, (l+q-1)/q*q); m < r; m += q)
+        prime[m-l] = 0;
+    // Only the p-1 of primes p are factored, p = m+1 = l+i.
+    for (int q : base) {
+      for (llong m = std::max(1LL*q, (l-1+q-1)/q*q); m < r-1; m += q) {
+        const int i = m-(l-1);
+        if (prime[i]) fac[i*kMaxDistinctFactors + cnt[i]++] = q;
+      }
+    }
+
+    std::vector<PrimeInfo>& res = found[seg];
+    for (int i = 0; i < len; i++) {
+      const int p = l+i;
+      if (!prime[i] || p < 2) continue;
+      PrimeInfo info;
+      info.p = p;
+      if (p == 2) {
+        info.root = 1;
+        info.sqrt_minus_one = 1;
+        info.two_squares = PII(1, 1);
+        res.push_back(info);
+        continue;
+      }
+
+      // The prime factor above sqrt(hi), if any, is what remains.
+      int* fs = &fac[1LL*i*kMaxDistinctFactors];
+      int n = cnt[i], cof = p-1;
+      for (int j = 0; j < n; j++)
+        do cof /= fs[j]; while (cof%fs[j] == 0);
+      if (cof > 1) fs[n++] = cof;
+      const Montgomery32 mont(p);
+      unsigned root = 0;
+      for (int g = 2; ; g++) {
+        if (Jacobi(g, p) != -1) continue;
+        root = mont.To(g);
+        bool ok = true;
+        // fs[0] = 2 is done by the Jacobi symbol.
+        for (int j = 1; j < n && ok; j++)
+          ok = mont.Pow(root, (p-1)/fs[j]) != mont.One();
+        if (ok) {
+          info.root = g;
+          break;
+        }
+      }
+
+      if (p%4 == 1) {
+        info.sqrt_minus_one = mont.From(mont.Pow(root, (p-1)/4));
+        info.two_squares = CornacchiaPrime(p, info.sqrt_minus_one);
+      } else {
+        info.sqrt_minus_one = -1;
+        info.two_squares = PII(-1, -1);
+      }
+      res.push_back(info);
+    }
+  });
+
+  std::vector<PrimeInfo> res;
+  for (auto& v : found) res.insert(res.end(), v.begin(), v.end());
+  return res;
+}
+
 }  // namespace algo
 
 #endif  //ALGO_PRIMES_H_
@@ -1,10 +1,19 @@
 #ifndef ALGO_ROOTS_H_
 #define ALGO_ROOTS_H_
 
+#include <algorithm>
+#include <cassert>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
+#include "crt.h"
+#include "defs.h"
+#include "gcd.h"
 #include "modular.h"
+#include "parallel.h"
 
 namespace algo {
 
@@ -18,6 +27,24 @@ llong GetPower(llong p, int e)
 
 };
 
+llong MulMod(llong a, llong b, llong m)
+{
+  return i128(a)*b%m;
+}
+
+llong PowMod(llong a, llong n, llong m)
+{
+  llong res = 1%m;
+  for (a %= m; n > 0; n >>= 1) {
+    if (n&1) res = MulMod(res, a, m);
+    a = MulMod(a, a, m);
+  }
+  return res;
+}
+
+// Default number of baby steps stored per prime factor in DiscreteLog.
+const int kDiscreteLogTableSize = 1<<20;
+
 }  // namespace
 
 // Gets the smallest positive number i which satisfies r^i = 1 (mod p^e)
@@ -51,41 +78,396 @@ int PrimitiveRoot(llong p, const std::vector<int>& factors_of_phi_p)
   return PrimitiveRoot(p, 1, factors_of_phi_p);
 }
 
+// Open addressing hash table from residues to their baby step exponents,
+// with linear probing.
+class BabyStepTable {
+ public:
+  BabyStepTable() : mask(0), shift(64) {}
+  BabyStepTable(int n) {
+    int bits = 1;
+    while ((1LL<<bits) < 2LL*n) bits++;
+    keys = std::vector<llong>(1LL<<bits, -1);
+    values = std::vector<int>(1LL<<bits);
+    mask = (1LL<<bits)-1;
+    shift = 64-bits;
+  }
+
+  // Keeps the first value inserted for a key.
+  void Insert(llong key, int value) {
+    llong i = slot(key);
+    for (; keys[i] != -1; i = (i+1)&mask)
+      if (keys[i] == key) return;
+    keys[i] = key;
+    values[i] = value;
+  }
+
+  // Returns -1 if key is absent.
+  int Find(llong key) const {
+    for (llong i = slot(key); keys[i] != -1; i = (i+1)&mask)
+      if (keys[i] == key) return values[i];
+    return -1;
+  }
+
+ private:
+  llong slot(llong key) const {
+    return (ullong(key)*0x9E3779B97F4A7C15ULL) >> shift;
+  }
+
+  std::vector<llong> keys;
+  std::vector<int> values;
+  llong mask;
+  int shift;
+};
+
+// Discrete logarithms to a fixed base g modulo p^e.
+//
+// The order n of g is split by Pohlig-Hellman into its prime power factors
+// q^k. A log modulo q^k is found digit by digit in base q, and every digit is
+// a log in the subgroup of order q, solved by baby-step giant-step. The baby
+// steps are built once in the constructor and shared by all queries, so a
+// query costs O(\sum k (log n + q/m)) multiplications for tables of
+// m = min(q, table_size) baby steps. Larger tables make queries cheaper when
+// n has large prime factors.
+//
+// Restrictions:
+// - p must be an odd prime number, and p^e must be smaller than 10^18
+// - factors_of_phi_p are the prime factors of p-1
+class DiscreteLog {
+ public:
+  DiscreteLog(llong g, llong p, int e,
+              const std::vector<llong>& factors_of_phi_p,
+              int table_size = kDiscreteLogTableSize);
+
+  // The order of g modulo p^e.
+  llong GetOrder() const { return order; }
+
+  // Gets the smallest x >= 0 with g^x = a (mod p^e), or -1 if there is none.
+  llong Get(llong a) const;
+  // Same for many a, on given number of threads (all cores if threads <= 0).
+  std::vector<llong> Get(const std::vector<llong>& as, int threads = 1) const;
+
+ private:
+  struct Factor {
+    llong q;
+    int k;
+    // q^k and n/q^k.
+    llong qk;
+    llong cofactor;
+    // g^(n/q^k), of order q^k, and its inverse.
+    llong base;
+    llong base_inv;
+    // h = base^(q^(k-1)), of order q. The table has h^j for 0 <= j < m,
+    // and giant = h^(-m).
+    llong m;
+    llong giant;
+    BabyStepTable table;
+  };
+
+  // Gets log_h(c) for c in the subgroup of order q, or -1.
+  llong logPrime(const Factor& f, llong c) const;
+
+  llong pmod;
+  llong order;
+  std::vector<Factor> factors;
+};
+
+DiscreteLog::DiscreteLog(llong g, llong p, int e,
+                         const std::vector<llong>& factors_of_phi_p,
+                         int table_size)
+    : pmod(GetPower(p, e)) {
+  assert(p > 2 && e >= 1 && table_size >= 1);
+  g %= pmod;
+  if (g < 0) g += pmod;
+  assert(g%p != 0);
+
+  std::vector<llong> primes = factors_of_phi_p;
+  if (e > 1) primes.push_back(p);
+  order = pmod/p*(p-1);
+  for (llong r : primes)
+    while (order%r == 0 && PowMod(g, order/r, pmod) == 1) order /= r;
+
+  for (llong q : primes) {
+    if (order%q != 0) continue;
+    Factor f;
+    f.q = q;
+    f.k = 0;
+    f.qk = 1;
+    while (order/f.qk%q == 0) f.qk *= q, f.k++;
+    f.cofactor = order/f.qk;
+    f.base = PowMod(g, f.cofactor, pmod);
+    f.base_inv = PowMod(f.base, f.qk-1, pmod);
+
+    const llong h = PowMod(f.base, f.qk/q, pmod);
+    f.m = std::min<llong>(q, table_size);
+    f.table = BabyStepTable(f.m);
+    llong x = 1;
+    for (int j = 0; j < f.m; j++, x = MulMod(x, h, pmod)) f.table.Insert(x, j);
+    f.giant = PowMod(h, (q-f.m%q)%q, pmod);
+    factors.push_back(std::move(f));
+  }
+}
+
+llong DiscreteLog::logPrime(const Factor& f, llong c) const {
+  for (llong i = 0; i*f.m < f.q; i++, c = MulMod(c, f.giant, pmod)) {
+    int j = f.table.Find(c);
+    if (j >= 0) return i*f.m+j;
+  }
+  return -1;
+}
+
+llong DiscreteLog::Get(llong a) const {
+  a %= pmod;
+  if (a < 0) a += pmod;
+  // In a cyclic group, a is a power of g iff a^n = 1.
+  if (PowMod(a, order, pmod) != 1) return -1;
+
+  CRT<llong> crt;
+  for (const Factor& f : factors) {
+    const llong aq = PowMod(a, f.cofactor, pmod);
+    // x = d_0 + d_1 q + ... and (aq * base^-(d_0 + ... + d_{i-1} q^{i-1}))
+    // raised to q^(k-1-i) is h^(d_i).
+    llong x = 0, qi = 1, rest = aq;
+    for (int i = 0; i < f.k; i++, qi *= f.q) {
+      llong d = logPrime(f, PowMod(rest, f.qk/qi/f.q, pmod));
+      if (d < 0) return -1;
+      x += d*qi;
+      rest = MulMod(rest, PowMod(f.base_inv, d*qi, pmod), pmod);
+    }
+    crt.Merge(x, f.qk);
+  }
+  return crt.GetSolution();
+}
+
+std::vector<llong> DiscreteLog::Get(const std::vector<llong>& as,
+                                    int threads) const {
+  std::vector<llong> res(as.size());
+  ParallelFor(0, as.size(), threads, [this, &as, &res](llong i, int) {
+    res[i] = Get(as[i]);
+  });
+  return res;
+}
+
+// k-th roots modulo a fixed odd prime p, for many values.
+//
+// Everything depending only on p is found once: for every prime r | p-1, with
+// p-1 = r^s * t, an r-th power non-residue z gives the generator c_r = z^t of
+// the Sylow r-subgroup. Square roots use Tonelli-Shanks with the powers
+// c_2^(2^i) cached, so they need no search for a non-residue and no
+// exponentiation inside the loop.
+//
+// Other roots use Adleman-Manders-Miller: an r^e-th root of a is a^u, with
+// u = r^(-e) mod t, corrected by an element of the Sylow r-subgroup. The
+// correction comes from a discrete log to base c_r, i.e. Pohlig-Hellman in
+// that subgroup. Those DiscreteLog tables are built when first needed, with
+// at most table_size baby steps each.
+//
+// Restrictions:
+// - p must be an odd prime number smaller than 10^18
+// - factors_of_phi_p are the prime factors of p-1
+class ModularRoots {
+ public:
+  ModularRoots(llong p_, const std::vector<llong>& factors_of_phi_p,
+               int table_size_ = kDiscreteLogTableSize);
+
+  // Gets one x with x^2 = n (mod p), or -1 if there is none.
+  llong SquareRoot(llong n) const;
+  // Gets one x with x^k = n (mod p) for k >= 1, or -1 if there is none.
+  llong KthRoot(llong n, llong k) const;
+  // Gets all x with x^k = n (mod p) for k >= 1, in increasing order.
+  std::vector<llong> AllKthRoots(llong n, llong k) const;
+
+  // Same as above for many n, on given number of threads (all cores if
+  // threads <= 0).
+  std::vector<llong> SquareRoots(const std::vector<llong>& ns,
+                                 int threads = 1) const;
+  std::vector<llong> KthRoots(const std::vector<llong>& ns, llong k,
+                              int threads = 1) const;
+
+ private:
+  struct Sylow {
+    llong r;
+    int s;
+    llong t;
+    // c_r, of order r^s.
+    llong gen;
+  };
+
+  // Gets x with x^(r^e) = a, for an r^e-th power residue a.
+  llong primePowerRoot(int index, int e, llong a) const;
+  // Gets the discrete log to base c_r, built at first use.
+  const DiscreteLog& sylowLog(int index) const;
+
+  llong p;
+  std::vector<llong> factors;
+  int table_size;
+  std::vector<Sylow> sylows;
+  // p-1 = q*2^s2, and c_pows[i] = c_2^(2^i) for 0 <= i <= s2.
+  llong q;
+  int s2;
+  std::vector<llong> c_pows;
+
+  mutable std::vector<std::unique_ptr<DiscreteLog>> logs;
+  std::unique_ptr<std::once_flag[]> log_once;
+};
+
+ModularRoots::ModularRoots(llong p_, const std::vector<llong>& factors_of_phi_p,
+                           int table_size_)
+    : p(p_), factors(factors_of_phi_p), table_size(table_size_),
+      logs(factors_of_phi_p.size()),
+      log_once(new std::once_flag[factors_of_phi_p.size()]) {
+  assert(p > 2);
+  for (llong r : factors) {
+    Sylow f;
+    f.r = r;
+    f.s = 0;
+    f.t = p-1;
+    while (f.t%r == 0) f.t /= r, f.s++;
+    llong z = 2;
+    while (PowMod(z, (p-1)/r, p) == 1) z++;
+    f.gen = PowMod(z, f.t, p);
+    sylows.push_back(f);
+  }
+
+  q = p-1;
+  s2 = 0;
+  while (q%2 == 0) q /= 2, s2++;
+  const int count = sylows.size();
+  int two = 0;
+  while (two < count && sylows[two].r != 2) two++;
+  assert(two < count);
+  c_pows = std::vector<llong>(s2+1);
+  c_pows[0] = sylows[two].gen;
+  for (int i = 1; i <= s2; i++) c_pows[i] = MulMod(c_pows[i-1], c_pows[i-1], p);
+}
+
+llong ModularRoots::SquareRoot(llong n) const {
+  n %= p;
+  if (n < 0) n += p;
+  if (n == 0) return 0;
+  if (PowMod(n, (p-1)/2, p) != 1) return -1;
+
+  // Invariant: r^2 = n*t, and t is in the Sylow 2-subgroup. When t has order
+  // 2^i, r*b with b = c_2^(2^(s2-i-1)) reduces it, as b^2 has order 2^i too.
+  llong t = PowMod(n, q, p), r = PowMod(n, (q+1)/2, p);
+  while (t != 1) {
+    int i = 0;
+    for (llong x = t; x != 1; x = MulMod(x, x, p)) i++;
+    r = MulMod(r, c_pows[s2-i-1], p);
+    t = MulMod(t, c_pows[s2-i], p);
+  }
+  return r;
+}
+
+const DiscreteLog& ModularRoots::sylowLog(int index) const {
+  std::call_once(log_once[index], [this, index]() {
+    logs[index].reset(
+        new DiscreteLog(sylows[index].gen, p, 1, factors, table_size));
+  });
+  return *logs[index];
+}
+
+llong ModularRoots::primePowerRoot(int index, int e, llong a) const {
+  const Sylow& f = sylows[index];
+  llong re = GetPower(f.r, e);
+
+  // (r^e*u - 1) is a multiple of t, so x0^(r^e) = a*err with err in the
+  // Sylow subgroup, and err = c^L with r^e | L as a is a residue.
+  llong u, v;
+  ExtendGcd(re%f.t, f.t, 1LL, u, v);
+  const llong x0 = PowMod(a, u, p);
+  const llong err = PowMod(a, re*u == 0 ? p-2 : re*u-1, p);
+  const llong l = sylowLog(index).Get(err);
+  if (l < 0 || l%re != 0) return -1;
+
+  const llong order = GetPower(f.r, f.s);
+  return MulMod(x0, PowMod(f.gen, (order-l/re)%order, p), p);
+}
+
+llong ModularRoots::KthRoot(llong n, llong k) const {
+  assert(k >= 1);
+  n %= p;
+  if (n < 0) n += p;
+  if (n == 0) return 0;
+
+  // With y^d = n for d = gcd(k, p-1), x = y^v for v = (k/d)^(-1) modulo
+  // (p-1)/d works, since n^((p-1)/d) = 1.
+  const llong d = BinaryGcd(k, p-1);
+  if (PowMod(n, (p-1)/d, p) != 1) return -1;
+
+  // The d-th root is taken one prime power r^e || d at a time. Every step
+  // keeps a residue for the rest of d, as it multiplies a power of n by an
+  // element of the Sylow r-subgroup, which is an m-th power for all m
+  // coprime to r.
+  llong y = n;
+  const int count = sylows.size();
+  for (int i = 0; i < count; i++) {
+    int e = 0;
+    for (llong rest = d; rest%sylows[i].r == 0; rest /= sylows[i].r) e++;
+    if (e == 0) continue;
+    y = sylows[i].r == 2 && e == 1 ? SquareRoot(y) : primePowerRoot(i, e, y);
+    if (y < 0) return -1;
+  }
+
+  llong v, w;
+  const llong m = (p-1)/d;
+  ExtendGcd(k/d%m, m, 1LL, v, w);
+  return PowMod(y, v, p);
+}
+
+std::vector<llong> ModularRoots::AllKthRoots(llong n, llong k) const {
+  const llong x = KthRoot(n, k);
+  if (x < 0) return std::vector<llong>();
+  if (x == 0) return std::vector<llong>(1, 0);
+
+  // The roots are x*w^i for an element w of order d = gcd(k, p-1), made of
+  // the Sylow generators.
+  const llong d = BinaryGcd(k, p-1);
+  llong w = 1;
+  for (const Sylow& f : sylows) {
+    int e = 0;
+    for (llong rest = d; rest%f.r == 0; rest /= f.r) e++;
+    if (e > 0) w = MulMod(w, PowMod(f.gen, GetPower(f.r, f.s-e), p), p);
+  }
+
+  std::vector<llong> res(d);
+  res[0] = x;
+  for (llong i = 1; i < d; i++) res[i] = MulMod(res[i-1], w, p);
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+std::vector<llong> ModularRoots::SquareRoots(const std::vector<llong>& ns,
+                                             int threads) const {
+  std::vector<llong> res(ns.size());
+  ParallelFor(0, ns.size(), threads, [this, &ns, &res](llong i, int) {
+    res[i] = SquareRoot(ns[i]);
+  });
+  return res;
+}
+
+std::vector<llong> ModularRoots::KthRoots(const std::vector<llong>& ns,
+                                          llong k, int threads) const {
+  std::vector<llong> res(ns.size());
+  ParallelFor(0, ns.size(), threads, [this, &ns, k, &res](llong i, int) {
+    res[i] = KthRoot(ns[i], k);
+  });
+  return res;
+}
+
 // Find one solution to x^2 = n (mod p) using Tonelli-Shanks algorithm
 // Restrictions:
 // - the root must exist, i.e., n^{(p-1)/2} = 1 (mod p)
 // - p must be a prime number
 // - p must be smaller than 10^18
 // If no solutions, the method will return -1.
+//
+// It builds a ModularRoots context on every call. Use one directly for many
+// values under the same p.
 llong SquareRoot(llong n, llong p, const std::vector<int>& factors_of_phi_p)
 {
-  if (n == 0) return 0;
-
-  // Find p-1 = Q*2^S
-  llong s = 0, q = p-1;
-  while (q%2 == 0) {
-    q /= 2;
-    s++;
-  }
-
-  llong z = PrimitiveRoot(p, factors_of_phi_p);
-  llong m = s, c = powR64(z, q, p), t = powR64(n, q, p), r = powR64(n, (q+1)/2, p);
-  
-  while (t != 1) {
-    //printf("n = %lld, p = %lld, s = %lld, q = %lld, t = %lld, c = %lld, r = %lld, m = %lld\n", n, p, s, q, t, c, r, m);
-    int i = 1;
-    llong ct = multiply64(t, t, p);
-    for (; i < m && ct != 1; i++) ct = multiply64(ct, ct, p);
-    if (i == m) return -1;
-
-    llong b = powR64(c, 1LL<<(m-i-1), p);
-    m = i;
-    c = multiply64(b, b, p);
-    t = multiply64(t, multiply64(b, b, p), p);
-    r = multiply64(r, b, p);
-  }
-
-  return r;
+  if (p == 2) return n%2;
+  std::vector<llong> factors(factors_of_phi_p.begin(), factors_of_phi_p.end());
+  return ModularRoots(p, factors).SquareRoot(n);
 }
 
 // Given a solution r to f(r) = 0 (mod p^e), find the solution r' to
@@ -0,0 +1,153 @@
+#ifndef ALGO_SIEVE_PROBE_H_
+#define ALGO_SIEVE_PROBE_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+
+namespace algo {
+
+// Instrumentation of the sieve engines: per-phase timers, counters, and a
+// throttled progress callback.
+//
+// It only works when ALGO_INSTRUMENTATION is defined before including any
+// header. Otherwise all hooks are empty inline functions, and the engines run
+// exactly as fast as without them: SieveProbe is then empty, and the engines
+// holding one stay copyable and movable. The macro changes the layout and the
+// inline bodies, so it must be the same in every translation unit of a
+// program.
+
+enum SieveCounter {
+  // Calls into the user provided functions.
+  kCallbackCalls,
+  // Updates of quotient-indexed table entries.
+  kQuotientUpdates,
+  // Nodes visited in the tree of multiples.
+  kRecursionNodes,
+  kSieveCounterCount,
+};
+
+struct SieveStats {
+  llong counters[kSieveCounterCount] = {};
+  // Pairs of (phase name, seconds spent) in the order of finishing.
+  std::vector<std::pair<std::string, double>> phases;
+};
+
+// Receives the events of an instrumented engine. Both methods are called on
+// the thread which calculates, and never concurrently. OnPhase gets the name
+// of a finished phase and its seconds, OnProgress the name of the current
+// phase with (done, total).
+class SieveListener {
+ public:
+  virtual ~SieveListener() {}
+
+  virtual void OnPhase(const std::string&, double) {}
+  // At most once per interval given in SieveProbe::SetListener.
+  virtual void OnProgress(const std::string&, llong, llong) {}
+};
+
+class SieveProbe {
+ public:
+  class Phase;
+
+  SieveProbe() {}
+
+#ifdef ALGO_INSTRUMENTATION
+  void SetListener(SieveListener* listener_, double interval_) {
+    listener = listener_;
+    interval = interval_;
+  }
+
+  SieveStats GetStats() const {
+    SieveStats res;
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < kSieveCounterCount; i++) res.counters[i] = counters[i];
+    res.phases = phases;
+    return res;
+  }
+
+  // Adds the counters of another engine, e.g. the one used internally.
+  void Merge(const SieveStats& stats) {
+    for (int i = 0; i < kSieveCounterCount; i++)
+      counters[i].fetch_add(stats.counters[i], std::memory_order_relaxed);
+  }
+
+  // Safe to call from multiple threads.
+  void Count(SieveCounter counter, llong n = 1) {
+    counters[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // Safe to call from multiple threads. Calls are dropped when the last
+  // report is less than an interval ago, or another thread is reporting.
+  void Progress(const char* phase, llong done, llong total) {
+    if (listener == nullptr) return;
+    const llong now =
+        std::chrono::steady_clock::now().time_since_epoch().count();
+    if (now < next_report.load(std::memory_order_relaxed) ||
+        !report_lock.try_lock()) {
+      return;
+    }
+    // Checked again, as another thread may have reported in between.
+    if (now >= next_report.load(std::memory_order_relaxed)) {
+      next_report.store(
+          now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(interval)).count(),
+          std::memory_order_relaxed);
+      listener->OnProgress(phase, done, total);
+    }
+    report_lock.unlock();
+  }
+
+ private:
+  SieveListener* listener = nullptr;
+  double interval = 0;
+  std::atomic<llong> counters[kSieveCounterCount] = {};
+  std::vector<std::pair<std::string, double>> phases;
+  mutable std::mutex lock;
+  std::mutex report_lock;
+  // Ticks of steady_clock before which progress is not reported. Written
+  // under report_lock, but read without it.
+  std::atomic<llong> next_report{0};
+#else
+  void SetListener(SieveListener*, double) {}
+  SieveStats GetStats() const { return SieveStats(); }
+  void Merge(const SieveStats&) {}
+  void Count(SieveCounter, llong = 1) {}
+  void Progress(const char*, llong, llong) {}
+#endif
+};
+
+// Times a phase of the calculation, from construction to destruction.
+class SieveProbe::Phase {
+ public:
+#ifdef ALGO_INSTRUMENTATION
+  Phase(SieveProbe* probe_, const char* name_)
+      : probe(probe_), name(name_), start(std::chrono::steady_clock::now()) {}
+
+  ~Phase() {
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> guard(probe->lock);
+      probe->phases.push_back(std::make_pair(name, seconds));
+    }
+    if (probe->listener != nullptr) probe->listener->OnPhase(name, seconds);
+  }
+
+ private:
+  SieveProbe* probe;
+  const char* name;
+  std::chrono::steady_clock::time_point start;
+#else
+  Phase(SieveProbe*, const char*) {}
+#endif
+};
+
+}  // namespace algo
+
+#endif  // ALGO_SIEVE_PROBE_H_
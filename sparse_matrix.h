@@ -0,0 +1,258 @@
+#ifndef ALGO_SPARSE_MATRIX_H_
+#define ALGO_SPARSE_MATRIX_H_
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <vector>
+
+#include "defs.h"
+#include "linear_recursion.h"
+#include "parallel.h"
+
+namespace algo {
+
+// A sparse matrix in compressed sparse row (CSR) form. It only supports
+// multiplying vectors, which is all the black-box algorithms below need.
+template <typename T>
+class SparseMatrix {
+ public:
+  struct Entry {
+    int row;
+    int col;
+    T value;
+  };
+
+  // Entries at the same position are summed up.
+  SparseMatrix(int rows_, int cols_, const std::vector<Entry>& entries);
+
+  int GetRows() const { return rows; }
+  int GetCols() const { return cols; }
+  llong GetNonZeros() const { return value.size(); }
+
+  // Returns m*v, on given number of threads (all cores if threads <= 0).
+  std::vector<T> Multiply(const std::vector<T>& v, int threads = 1) const;
+  std::vector<T> operator*(const std::vector<T>& v) const {
+    return Multiply(v);
+  }
+
+  // Returns m*D for the diagonal matrix D = diag(d).
+  SparseMatrix<T> ScaleColumns(const std::vector<T>& d) const {
+    SparseMatrix<T> res = *this;
+    const llong size = value.size();
+    for (llong k = 0; k < size; k++) res.value[k] *= d[index[k]];
+    return res;
+  }
+
+ private:
+  int rows;
+  int cols;
+  // The entries of row i are index/value[start[i] ... start[i+1]-1].
+  std::vector<llong> start;
+  std::vector<int> index;
+  std::vector<T> value;
+};
+
+template <typename T>
+SparseMatrix<T>::SparseMatrix(int rows_, int cols_,
+                              const std::vector<Entry>& entries)
+    : rows(rows_), cols(cols_), start(rows_+1, 0) {
+  for (const Entry& e : entries) {
+    assert(0 <= e.row && e.row < rows && 0 <= e.col && e.col < cols);
+    start[e.row+1]++;
+  }
+  for (int i = 0; i < rows; i++) start[i+1] += start[i];
+
+  index.resize(entries.size());
+  value.resize(entries.size());
+  std::vector<llong> next(start.begin(), start.end()-1);
+  for (const Entry& e : entries) {
+    index[next[e.row]] = e.col;
+    value[next[e.row]++] = e.value;
+  }
+}
+
+template <typename T>
+std::vector<T> SparseMatrix<T>::Multiply(const std::vector<T>& v,
+                                         int threads) const {
+  assert(int(v.size()) == cols);
+  std::vector<T> res(rows, T(0));
+  // Rows are handed out in chunks, as a single row is cheap.
+  const llong chunk = 1<<10;
+  ParallelFor(0, (rows+chunk-1)/chunk, threads,
+      [this, &v, &res, chunk](llong c, int) {
+    for (llong i = c*chunk; i < rows && i < (c+1)*chunk; i++) {
+      T sum = T(0);
+      for (llong k = start[i]; k < start[i+1]; k++)
+        sum += value[k] * v[index[k]];
+      res[i] = sum;
+    }
+  });
+  return res;
+}
+
+// Wiedemann's algorithm: black-box linear algebra for a square sparse matrix
+// A over a (large) field T, using only O(n) products of A with vectors, i.e.
+// O(n * nnz) time and O(n + nnz) memory.
+//
+// The minimal polynomial of A with respect to v is found as the minimum
+// linear recursion of the scalar sequence u^T A^i v for a random u. It is
+// correct with high probability when T is large, and the results are
+// verified, with a few retries with other random vectors.
+
+namespace {
+
+const int kWiedemannAttempts = 4;
+
+template <typename T>
+T RandomElement(std::mt19937_64& rng) {
+  return T(llong(rng() >> 2));
+}
+
+// Gets the minimum linear recursion of u^T A^i v for 0 <= i < 2n and a
+// random u, in the form of FindMinimumLinearRecursion.
+template <typename T>
+std::vector<T> KrylovRecursion(const SparseMatrix<T>& a,
+                               const std::vector<T>& v,
+                               std::mt19937_64& rng, int threads) {
+  const int n = a.GetRows();
+  std::vector<T> u(n);
+  for (T& x : u) x = RandomElement<T>(rng);
+
+  std::vector<T> seq(2*n), w = v;
+  for (int i = 0; i < 2*n; i++) {
+    T s = T(0);
+    for (int j = 0; j < n; j++) s += u[j] * w[j];
+    seq[i] = s;
+    if (i+1 < 2*n) w = a.Multiply(w, threads);
+  }
+  return FindMinimumLinearRecursion(seq);
+}
+
+template <typename T>
+bool IsZero(const std::vector<T>& v) {
+  for (const T& x : v) if (x != T(0)) return false;
+  return true;
+}
+
+}  // namespace
+
+// Gets A^k v.
+// Returns an empty vector if no minimal polynomial could be verified, which
+// only happens with negligible probability over a large field.
+template <typename T>
+std::vector<T> PowTimesVector(const SparseMatrix<T>& a, llong k,
+                              const std::vector<T>& v, int threads = 1) {
+  const int n = a.GetRows();
+  assert(a.GetCols() == n && int(v.size()) == n);
+
+  // Up to 2n, plain products are cheaper than finding the recursion.
+  if (k <= 2*n || IsZero(v)) {
+    std::vector<T> w = v;
+    for (llong i = 0; i < k && !IsZero(w); i++) w = a.Multiply(w, threads);
+    return w;
+  }
+
+  std::mt19937_64 rng(n);
+  for (int attempt = 0; attempt < kWiedemannAttempts; attempt++) {
+    std::vector<T> c = KrylovRecursion(a, v, rng, threads);
+    const int d = c.size();
+    if (d == 0) continue;
+
+    // x^k = \sum_j r[j] x^j modulo the minimal polynomial. One pass over
+    // A^j v gives both the result, and A^d v - \sum_j c[j] A^j v, which must
+    // be zero for a correct minimal polynomial.
+    std::vector<T> r = FindNthElementLinearRepresenation(c, k);
+    std::vector<T> res(n, T(0)), check(n, T(0)), w = v;
+    for (int j = 0; j < d; j++) {
+      for (int i = 0; i < n; i++) {
+        res[i] += r[j] * w[i];
+        check[i] -= c[j] * w[i];
+      }
+      w = a.Multiply(w, threads);
+    }
+    for (int i = 0; i < n; i++) check[i] += w[i];
+    if (IsZero(check)) return res;
+  }
+  return std::vector<T>();
+}
+
+// Finds the solution x of A*x = b for a non-singular A.
+// Returns false if A is (most likely) singular.
+template <typename T>
+bool Solve(const SparseMatrix<T>& a, const std::vector<T>& b,
+           std::vector<T>& x, int threads = 1) {
+  const int n = a.GetRows();
+  assert(a.GetCols() == n && int(b.size()) == n);
+
+  std::mt19937_64 rng(n);
+  for (int attempt = 0; attempt < kWiedemannAttempts; attempt++) {
+    // With mu(A) b = 0 and mu(0) != 0, x = -(mu(A) - mu(0)) / (A mu(0)) b.
+    std::vector<T> c = KrylovRecursion(a, b, rng, threads);
+    const int d = c.size();
+    if (d == 0) {
+      x = std::vector<T>(n, T(0));
+      return true;
+    }
+    if (c[0] == T(0)) continue;
+
+    // mu(x) = x^d - \sum_j c[j] x^j, and x = (1/c[0]) \sum_{j>0} mu_j A^{j-1} b
+    const T scale = T(1)/c[0];
+    std::vector<T> sol(n, T(0)), w = b;
+    for (int j = 1; j <= d; j++) {
+      const T coef = (j == d ? T(1) : -c[j]) * scale;
+      for (int i = 0; i < n; i++) sol[i] += coef * w[i];
+      if (j < d) w = a.Multiply(w, threads);
+    }
+
+    std::vector<T> check = a.Multiply(sol, threads);
+    bool ok = true;
+    for (int i = 0; i < n && ok; i++) ok = check[i] == b[i];
+    if (ok) {
+      x = sol;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Gets the determinant of A.
+//
+// A is multiplied by a random diagonal matrix D, so that with high
+// probability the minimal polynomial of AD is its characteristic polynomial,
+// and det(A) = (-1)^n mu(0) / det(D). Returns 0 if that fails in all attempts,
+// which means A is singular with high probability.
+template <typename T>
+T Determinant(const SparseMatrix<T>& a, int threads = 1) {
+  const int n = a.GetRows();
+  assert(a.GetCols() == n);
+
+  std::mt19937_64 rng(n);
+  for (int attempt = 0; attempt < kWiedemannAttempts; attempt++) {
+    std::vector<T> diag(n);
+    T det_diag = T(1);
+    for (T& x : diag) {
+      do x = RandomElement<T>(rng); while (x == T(0));
+      det_diag *= x;
+    }
+
+    SparseMatrix<T> ad = a.ScaleColumns(diag);
+
+    std::vector<T> v(n);
+    for (T& x : v) x = RandomElement<T>(rng);
+    std::vector<T> c = KrylovRecursion(ad, v, rng, threads);
+    // A polynomial with mu(0) = 0 divides the minimal polynomial of AD, so
+    // AD is singular for sure.
+    if (!c.empty() && c[0] == T(0)) return T(0);
+    if (int(c.size()) < n) continue;
+
+    // mu(0) = -c[0]
+    T det = n%2 == 0 ? -c[0] : c[0];
+    return det / det_diag;
+  }
+  return T(0);
+}
+
+}  // namespace algo
+
+#endif  // ALGO_SPARSE_MATRIX_H_
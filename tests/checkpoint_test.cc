@@ -0,0 +1,170 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "multiplicitive_prime_sum.h"
+#include "multiplicitive_sum2.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+std::string TempPath(const char* name) {
+  return "/tmp/algo_" + std::to_string(getpid()) + "_" + name;
+}
+
+// pi[i] is the number of primes <= i, mu[i] the Moebius function.
+void BruteForce(int n, std::vector<llong>& pi, std::vector<int>& mu) {
+  std::vector<bool> composite(n+1);
+  std::vector<int> primes;
+  pi.assign(n+1, 0);
+  mu.assign(n+1, 1);
+  for (int i = 2; i <= n; i++) {
+    if (!composite[i]) {
+      primes.push_back(i);
+      mu[i] = -1;
+    }
+    for (int p : primes) {
+      if (1LL*i*p > n) break;
+      composite[i*p] = true;
+      if (i%p == 0) {
+        mu[i*p] = 0;
+        break;
+      }
+      mu[i*p] = -mu[i];
+    }
+    pi[i] = pi[i-1] + (composite[i] ? 0 : 1);
+  }
+}
+
+void TestSections() {
+  const std::string path = TempPath("sections.ckpt");
+  unlink(path.c_str());
+  const std::vector<CheckpointSection> sections = {{10, true}, {5, false}};
+  {
+    auto ck = SieveCheckpoint<llong>::Create(path, kPrimeSumCheckpoint, 100,
+                                             sections, 0);
+    Check(ck != nullptr && ck->GetProgress() == -1 && !ck->IsFinished(),
+          "a new checkpoint has nothing committed");
+    for (int i = 0; i < 10; i++) ck->Write(0)[i] = i;
+    for (int i = 0; i < 5; i++) ck->Write(1)[i] = 100+i;
+    ck->Commit(3, false);
+    // Not committed: the buffered section keeps the last commit.
+    for (int i = 0; i < 10; i++) ck->Write(0)[i] = -1;
+  }
+  Check(SieveCheckpoint<llong>::OpenReadOnly(path, kPrimeSumCheckpoint) ==
+            nullptr,
+        "an unfinished checkpoint is not opened read-only");
+  {
+    auto ck = SieveCheckpoint<llong>::Create(path, kPrimeSumCheckpoint, 100,
+                                             sections, 0);
+    bool ok = ck != nullptr && ck->GetProgress() == 3;
+    for (int i = 0; ok && i < 10; i++) ok = ck->Read(0)[i] == i;
+    for (int i = 0; ok && i < 5; i++) ok = ck->Read(1)[i] == 100+i;
+    Check(ok, "a reopened checkpoint holds the last commit");
+    std::copy(ck->Read(0), ck->Read(0)+10, ck->Write(0));
+    ck->Commit(4, true);
+  }
+  {
+    auto ck = SieveCheckpoint<llong>::OpenReadOnly(path, kPrimeSumCheckpoint);
+    Check(ck != nullptr && ck->GetN() == 100 && ck->IsFinished() &&
+              ck->GetSectionSize(0) == 10 && ck->Read(0)[9] == 9,
+          "a finished checkpoint is opened read-only");
+    Check(SieveCheckpoint<llong>::OpenReadOnly(
+              path, kMultiplicitiveSum2Checkpoint) == nullptr,
+          "a checkpoint is not opened as another kind");
+  }
+  {
+    auto ck = SieveCheckpoint<llong>::Create(path, kPrimeSumCheckpoint, 101,
+                                             sections, 0);
+    Check(ck != nullptr && ck->GetProgress() == -1,
+          "a checkpoint of another n starts over");
+  }
+  unlink(path.c_str());
+}
+
+// Counts primes, where 1 counts as a prime too.
+void TestPrimeSum(const std::vector<llong>& pi) {
+  const llong n = pi.size()-1;
+  const std::string path = TempPath("prime_sum.ckpt");
+  unlink(path.c_str());
+  auto count = [](llong k) -> llong { return k; };
+  for (int run = 0; run < 2; run++) {
+    MultiplicitivePrimeSum<llong> mps(n);
+    Check(mps.GetSumOverPrimes(count, path, 0), "prime sum checkpoint opens");
+    auto mapped = MappedPrimeSum<llong>::Open(path);
+    bool ok = mapped != nullptr && mapped->GetN() == n;
+    for (llong k = 1; ok && k <= n; k = n/(n/k)+1) {
+      const llong v = n/k;
+      ok = mps.GetSum(v) == pi[v]+1 && mapped->GetSum(v) == pi[v]+1;
+    }
+    Check(ok, run == 0 ? "prime counts from a new checkpoint"
+                       : "prime counts from a finished checkpoint");
+  }
+  unlink(path.c_str());
+}
+
+// The Mertens function with f = mu, g = 1, r = [n == 1]. A first run in a
+// child process is cut off after about a third of the calls to g, halfway
+// through the large sums, and the second one resumes it.
+void TestResumeMultiplicitiveSum2(const std::vector<int>& mu) {
+  const llong n = mu.size()-1;
+  const std::string path = TempPath("sum2.ckpt");
+  unlink(path.c_str());
+  auto f = [](llong, int e) -> llong { return e == 1 ? -1 : 0; };
+  auto g = [](llong m) -> llong { return m; };
+  auto r = [](llong) -> llong { return 1; };
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int calls = 0;
+    auto cut = [&calls](llong m) -> llong {
+      if (++calls == 100000) _exit(0);
+      return m;
+    };
+    MultiplicitiveSum2<llong> sum(n);
+    sum.Calculate(f, cut, r, path, 0);
+    _exit(1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  Check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        "the first run is cut off");
+  {
+    auto ck = SieveCheckpoint<llong>::OpenReadOnly(
+        path, kMultiplicitiveSum2Checkpoint);
+    Check(ck == nullptr, "the cut off run is unfinished");
+  }
+
+  MultiplicitiveSum2<llong> sum(n);
+  Check(sum.Calculate(f, g, r, path, 0), "Mertens checkpoint opens");
+  auto mapped = MappedMultiplicitiveSum2<llong>::Open(path);
+  bool ok = mapped != nullptr;
+  llong mertens = 0;
+  std::vector<llong> prefix(n+1);
+  for (llong i = 1; i <= n; i++) prefix[i] = mertens += mu[i];
+  for (llong k = 1; ok && k <= n; k = n/(n/k)+1) {
+    const llong v = n/k;
+    ok = sum.GetPrefixSum(v) == prefix[v] &&
+         mapped->GetPrefixSum(v) == prefix[v];
+  }
+  Check(ok, "Mertens function from a resumed checkpoint");
+  unlink(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+  std::vector<llong> pi;
+  std::vector<int> mu;
+  BruteForce(10000000, pi, mu);
+  TestSections();
+  TestPrimeSum(pi);
+  TestResumeMultiplicitiveSum2(mu);
+  return TestResult();
+}
@@ -0,0 +1,102 @@
+#include <random>
+#include <vector>
+
+#include "crt.h"
+#include "defs.h"
+#include "gcd.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+// Every pair of congruences with small moduli, against a search over
+// [0, lcm).
+void TestMergeSmall() {
+  bool ok = true;
+  for (llong n1 = 1; n1 <= 12; n1++)
+    for (llong n2 = 1; n2 <= 12; n2++)
+      for (llong a1 = 0; a1 < n1; a1++)
+        for (llong a2 = 0; a2 < n2; a2++) {
+          const llong lcm = n1/BinaryGcd(n1, n2)*n2;
+          llong x = 0;
+          while (x < lcm && (x%n1 != a1 || x%n2 != a2)) x++;
+          CRT<llong> crt(a1, n1);
+          const bool merged = crt.Merge(a2, n2);
+          ok = ok && merged == (x < lcm);
+          if (merged) {
+            ok = ok && crt.GetSolution() == x && crt.GetModule() == lcm;
+          }
+        }
+  Check(ok, "CRT::Merge of small moduli");
+}
+
+// Moduli up to 2^31 whose product is close to 2^62.
+void TestMergeLarge() {
+  std::mt19937_64 rng(1);
+  bool ok = true;
+  for (int it = 0; it < 100000; it++) {
+    const llong n1 = rng()%(1LL<<31)+1, n2 = rng()%(1LL<<31)+1;
+    const llong lcm = n1/BinaryGcd(n1, n2)*n2;
+    const llong x = rng()%lcm;
+    CRT<llong> crt(x%n1, n1);
+    ok = ok && crt.Merge(x%n2, n2) && crt.GetSolution() == x &&
+         crt.GetModule() == lcm;
+  }
+  Check(ok, "CRT::Merge of moduli up to 2^31");
+}
+
+void TestMergeAll() {
+  const llong x = 123456789012345LL;
+  std::vector<CRT<llong>> cs;
+  for (llong m : {6LL, 10LL, 15LL, 49LL, 121LL, 1000003LL, 7LL})
+    cs.push_back(CRT<llong>(x%m, m));
+  CRT<llong> res;
+  Check(MergeAll(cs, res) && res.GetModule() == 30LL*49*121*1000003 &&
+            res.GetSolution() == x%res.GetModule(),
+        "MergeAll of consistent congruences");
+
+  cs.push_back(CRT<llong>(1-x%2, 2));
+  Check(!MergeAll(cs, res), "MergeAll of contradicting congruences");
+  Check(MergeAll(std::vector<CRT<llong>>(), res) && res.GetModule() == 1,
+        "MergeAll of no congruences");
+}
+
+// x up to about 2^93 from its residues modulo four primes, reduced modulo
+// targets that need 128-bit products.
+void TestGarner() {
+  const std::vector<llong> moduli = {2305843009213693951LL, 998244353,
+                                     1000000007, 167772161};
+  Garner garner(moduli);
+  std::mt19937_64 rng(2);
+  const int count = 1000;
+  std::vector<i128> xs(count);
+  std::vector<std::vector<llong>> residues(moduli.size(),
+                                           std::vector<llong>(count));
+  for (int j = 0; j < count; j++) {
+    xs[j] = i128(rng()>>1) * (rng()>>34) + rng()%1000;
+    for (int i = 0; i < int(moduli.size()); i++)
+      residues[i][j] = xs[j] % moduli[i];
+  }
+
+  for (llong target : {97LL, 1000000007LL, (1LL<<62)+12345}) {
+    const std::vector<llong> res = garner.Get(residues, target);
+    bool ok = true;
+    for (int j = 0; j < count; j++) ok = ok && res[j] == llong(xs[j]%target);
+    std::vector<llong> single;
+    for (int i = 0; i < int(moduli.size()); i++)
+      single.push_back(residues[i][7]);
+    ok = ok && garner.Get(single, target) == llong(xs[7]%target);
+    Check(ok, "Garner against 128-bit values");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestMergeSmall();
+  TestMergeLarge();
+  TestMergeAll();
+  TestGarner();
+  return TestResult();
+}
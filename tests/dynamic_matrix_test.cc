@@ -0,0 +1,30 @@
+#include "dynamic_matrix.h"
+#include "mod_num.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+// For P = 1099999997, fold_limit = 7(P-1)^2, so blocks of 8 or more terms of
+// (P-1)^2 used to overflow the lazy reduction.
+void TestLargeModulusAllMinusOne() {
+  typedef ModNum<1099999997> M;
+  for (int n : {16, 64, 72, 200}) {
+    DynamicMatrix<M> a(n);
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++) a[i][j] = M(-1);
+    DynamicMatrix<M> c = a*a;
+    bool ok = true;
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++) ok = ok && c[i][j] == M(n);
+    Check(ok, "(P-1)^2 products over ModNum<1099999997>");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestLargeModulusAllMinusOne();
+  return TestResult();
+}
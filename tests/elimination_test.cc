@@ -0,0 +1,55 @@
+#include <random>
+#include <vector>
+
+#include "dynamic_matrix.h"
+#include "elimination.h"
+#include "mod_num.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+bool IsIdentity(const DynamicMatrix<ModNum<1099999997>>& a) {
+  typedef ModNum<1099999997> M;
+  for (int i = 0; i < a.GetRows(); i++)
+    for (int j = 0; j < a.GetCols(); j++)
+      if (a[i][j] != M(i == j ? 1 : 0)) return false;
+  return true;
+}
+
+// Products over P = 1099999997 with more than 64 terms close to (P-1)^2
+// used to overflow the lazy reduction in dynamic_matrix.h. A is lower
+// triangular with entries close to P-1, so A*A is made of such products.
+void TestLargeModulusInverse() {
+  typedef ModNum<1099999997> M;
+  std::mt19937_64 rng(12345);
+  for (int n : {128, 130, 200}) {
+    DynamicMatrix<M> a(n);
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j <= i; j++) a[i][j] = M(-1-llong(rng()%16));
+    for (int threads : {1, 4}) {
+      DynamicMatrix<M> inv, square_inv;
+      Check(Inverse(a, inv, threads), "Inverse over ModNum<1099999997>");
+      Check(IsIdentity(Multiply(inv, a, threads)),
+            "Inverse(A)*A == I over ModNum<1099999997>");
+      Check(Inverse(Multiply(a, a, threads), square_inv, threads) &&
+                IsIdentity(Multiply(Multiply(square_inv, a, threads), a,
+                                    threads)),
+            "Inverse(A*A)*A*A == I over ModNum<1099999997>");
+    }
+
+    std::vector<M> x(n), b(n, M(0)), y;
+    for (int i = 0; i < n; i++) x[i] = M(-1-llong(rng()%16));
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++) b[i] += a[i][j]*x[j];
+    Check(Solve(a, b, y, 4) && y == x, "Solve over ModNum<1099999997>");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestLargeModulusInverse();
+  return TestResult();
+}
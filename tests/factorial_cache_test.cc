@@ -0,0 +1,60 @@
+#include <cmath>
+#include <vector>
+
+#include "defs.h"
+#include "factorial_cache.h"
+#include "mod_num.h"
+#include "numbers.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+// The cache grows in chunks of at least 1024 entries, which must not reach
+// past a small characteristic, where n! = 0.
+void TestSmallPrime() {
+  typedef ModNum<1009> M;
+  Numbers<M> numbers(10);
+  Check(numbers.C(5, 2) == M(10), "C(5, 2) mod 1009");
+  Check(numbers.inv(3) == M(673), "inv(3) mod 1009");
+
+  FactorialCache<M>& cache = FactorialCache<M>::Instance();
+  Check(cache.Factorial(1008)*cache.FactorialInverse(1008) == M(1),
+        "1008! * 1/1008! mod 1009");
+  Check(cache.Inverse(1008) == M(1008), "inv(1008) mod 1009");
+}
+
+void TestGrowth() {
+  typedef ModNum<998244353> M;
+  FactorialCache<M>& cache = FactorialCache<M>::Instance();
+  bool ok = true;
+  for (int i = 1; i < 100000; i += 97) {
+    ok = ok && cache.Inverse(i)*M(i) == M(1);
+    ok = ok && cache.Factorial(i) == cache.Factorial(i-1)*M(i);
+  }
+  Check(ok, "factorials and inverses mod 998244353");
+  Check(cache.C(100000, 3) == M(100000)*M(99999)*M(99998)/M(6),
+        "C(100000, 3) mod 998244353");
+}
+
+// The factorials of doubles overflow long before the end of the first
+// chunk, which must leave the small inverses intact.
+void TestDouble() {
+  FactorialCache<double>& cache = FactorialCache<double>::Instance();
+  Check(cache.FactorialInverse(4) == 1.0/24 && cache.Inverse(1000) == 1e-3,
+        "inverses of doubles");
+  PowerSumEvaluator<double> cubes(3);
+  Check(std::abs(cubes.Get(100)-25502500) < 1e-3 &&
+            std::abs(cubes.Get(std::vector<llong>{100})[0]-25502500) < 1e-3,
+        "sum of cubes with doubles");
+}
+
+}  // namespace
+
+int main() {
+  TestSmallPrime();
+  TestGrowth();
+  TestDouble();
+  return TestResult();
+}
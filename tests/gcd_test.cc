@@ -0,0 +1,84 @@
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "defs.h"
+#include "gcd.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+void TestBinaryGcd() {
+  bool ok = true;
+  for (llong a = -50; a <= 50; a++)
+    for (llong b = -50; b <= 50; b++)
+      ok = ok && BinaryGcd(a, b) == std::gcd(a, b);
+  std::mt19937_64 rng(1);
+  for (int it = 0; it < 100000; it++) {
+    const llong g = rng()%1000+1;
+    const llong a = llong(rng()>>4)/g*g, b = llong(rng()>>4)/g*g;
+    ok = ok && BinaryGcd(a, b) == std::gcd(a, b);
+    ok = ok && BinaryGcd(int(a%1000000), int(b%1000000)) ==
+               std::gcd(int(a%1000000), int(b%1000000));
+  }
+  Check(ok, "BinaryGcd against std::gcd");
+}
+
+// The solution must exist exactly when gcd | c, and x1 must be the
+// smallest non-negative one.
+void TestExtendGcd() {
+  bool ok = true;
+  for (llong n1 = 0; n1 <= 30; n1++)
+    for (llong n2 = 1; n2 <= 30; n2++)
+      for (llong c = -40; c <= 40; c++) {
+        llong x1 = 0, x2 = 0;
+        const bool solved = ExtendGcd(n1, n2, c, x1, x2);
+        const llong g = std::gcd(n1, n2);
+        ok = ok && solved == (c%g == 0);
+        if (solved) {
+          ok = ok && n1*x1 + n2*x2 == c && 0 <= x1 && x1 < n2/g;
+        }
+      }
+  std::mt19937_64 rng(2);
+  for (int it = 0; it < 100000; it++) {
+    const llong n1 = rng()%(1LL<<62), n2 = rng()%(1LL<<62)+1;
+    const llong g = std::gcd(n1, n2), c = g*llong(rng()%1000);
+    llong x1 = 0, x2 = 0;
+    ok = ok && ExtendGcd(n1, n2, c, x1, x2) &&
+         i128(n1)*x1 + i128(n2)*x2 == c && 0 <= x1 && x1 < n2/g;
+  }
+  Check(ok, "ExtendGcd solutions");
+}
+
+void TestFirstCommonDivisor() {
+  std::mt19937_64 rng(3);
+  const llong n = 1000000007LL*998244353LL;
+  for (int found : {-1, 0, 127, 128, 129, 1000}) {
+    std::vector<llong> a(1200);
+    for (llong& x : a) {
+      do {
+        x = rng()%n;
+      } while (std::gcd(x, n) != 1);
+    }
+    if (found >= 0) {
+      a[found] = 998244353LL*(rng()%1000+1);
+      a[found+37] = 1000000007LL*(rng()%1000+1);
+    }
+    int index = -2;
+    const llong g = FirstCommonDivisor(a, n, &index);
+    Check(found < 0 ? g == 1 && index == -1
+                    : g == 998244353LL && index == found,
+          "FirstCommonDivisor finds the first shared factor");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestBinaryGcd();
+  TestExtendGcd();
+  TestFirstCommonDivisor();
+  return TestResult();
+}
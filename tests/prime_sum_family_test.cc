@@ -0,0 +1,89 @@
+#include <vector>
+
+#include "gcd.h"
+#include "mod_num.h"
+#include "prime_sum_family.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+typedef ModNum<998244353> Z;
+
+// The distinct values of n/k, in increasing order.
+std::vector<llong> Quotients(llong n) {
+  std::vector<llong> res;
+  for (llong k = n; k >= 1; k = n/(n/k+1)) res.push_back(n/k);
+  return res;
+}
+
+// counts[q][a] and sums[q][a] are the number and the sum of the primes
+// p <= qs[q] with p = a (mod m).
+void BruteForce(llong n, int m, const std::vector<llong>& qs,
+                std::vector<std::vector<Z>>& counts,
+                std::vector<std::vector<Z>>& sums) {
+  std::vector<bool> composite(n+1);
+  std::vector<Z> count(m, Z(0)), sum(m, Z(0));
+  counts.clear();
+  sums.clear();
+  llong i = 2;
+  for (llong q : qs) {
+    for (; i <= q; i++) {
+      if (composite[i]) continue;
+      for (llong j = i*i; j <= n; j += i) composite[j] = true;
+      count[i%m] += Z(1);
+      sum[i%m] += Z(i);
+    }
+    counts.push_back(count);
+    sums.push_back(sum);
+  }
+}
+
+// \sum{ f(i) : 0 < i <= n and i = a (mod m) } for f(i) = i^e, e = 0 or 1.
+Z ResidueSum(llong n, int a, int m, int e) {
+  const llong first = a == 0 ? m : a;
+  if (n < first) return Z(0);
+  const llong c = (n-first)/m+1;
+  if (e == 0) return Z(c);
+  return Z(c)*Z(first) + Z(m)*Z(c)*Z(c-1)/Z(2);
+}
+
+// Both engines against brute force, for moduli whose exponent divides P-1.
+// The value 1 is counted as a prime in the residue class of 1.
+void TestAgainstBruteForce() {
+  const llong n = 2000000;
+  const std::vector<llong> qs = Quotients(n);
+  for (int m : {1, 4, 12, 16, 17, 30, 120}) {
+    std::vector<std::vector<Z>> counts, sums;
+    BruteForce(n, m, qs, counts, sums);
+    const int lambda = PrimeSumFamilyByCharacters<Z>::GetExponent(m);
+    const Z root = Z(3).pow((998244353-1)/lambda);
+    for (int e = 0; e < 2; e++) {
+      auto mf_sum = [m, e](llong k, int a) { return ResidueSum(k, a, m, e); };
+      PrimeSumFamily<Z> family(n, m);
+      family.GetSumOverPrimes(mf_sum);
+      PrimeSumFamilyByCharacters<Z> characters(n, m, root);
+      characters.GetSumOverPrimes(mf_sum, 3);
+
+      bool ok = true;
+      for (int q = 0; q < int(qs.size()); q++) {
+        for (int a = 0; a < m; a++) {
+          if (BinaryGcd(a, m) != 1) continue;
+          Z expected = e == 0 ? counts[q][a] : sums[q][a];
+          if (a == 1%m) expected += Z(1);
+          ok = ok && family.GetSum(a, qs[q]) == expected &&
+               characters.GetSum(a, qs[q]) == expected;
+        }
+      }
+      Check(ok, e == 0 ? "prime counts by residue" : "prime sums by residue");
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestAgainstBruteForce();
+  return TestResult();
+}
@@ -0,0 +1,88 @@
+#include <vector>
+
+#include "defs.h"
+#include "primes.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+bool IsPrime(llong n) {
+  if (n < 2) return false;
+  for (llong d = 2; d*d <= n; d++)
+    if (n%d == 0) return false;
+  return true;
+}
+
+llong PowMod(llong a, llong n, llong m) {
+  llong res = 1;
+  for (a %= m; n > 0; n >>= 1, a = a*a%m)
+    if (n&1) res = res*a%m;
+  return res;
+}
+
+bool IsPrimitiveRoot(llong g, llong p) {
+  llong n = p-1;
+  for (llong q = 2; q*q <= n; q++) {
+    if (n%q != 0) continue;
+    if (PowMod(g, (p-1)/q, p) == 1) return false;
+    while (n%q == 0) n /= q;
+  }
+  return n == 1 || PowMod(g, (p-1)/n, p) != 1;
+}
+
+// Checks infos against trial division for every number in [lo, hi]. The
+// root must be the smallest one, and the two squares the only ones.
+bool MatchesBruteForce(const std::vector<PrimeInfo>& infos, int lo, int hi) {
+  int next = 0;
+  for (llong p = lo; p <= hi; p++) {
+    if (!IsPrime(p)) continue;
+    if (next == int(infos.size()) || infos[next].p != p) return false;
+    const PrimeInfo& info = infos[next++];
+
+    if (p == 2) {
+      if (info.root != 1) return false;
+    } else {
+      if (!IsPrimitiveRoot(info.root, p)) return false;
+      for (llong g = 2; g < info.root; g++)
+        if (IsPrimitiveRoot(g, p)) return false;
+    }
+
+    if (p%4 == 3) {
+      if (info.sqrt_minus_one != -1 || info.two_squares != PII(-1, -1))
+        return false;
+      continue;
+    }
+    if (1LL*info.sqrt_minus_one*info.sqrt_minus_one%p != p-1) return false;
+    const llong a = info.two_squares.first, b = info.two_squares.second;
+    if (a <= 0 || a > b || a*a + b*b != p) return false;
+    if (TwoSquareSumDecompositionPrime(p) != info.two_squares) return false;
+  }
+  return next == int(infos.size());
+}
+
+void TestGetPrimeInfos() {
+  for (int threads : {1, 3}) {
+    Check(MatchesBruteForce(GetPrimeInfos(1, 30000, threads), 1, 30000),
+          "GetPrimeInfos of small primes");
+    // Across the segment boundary at 2^18.
+    const int b = 1<<18;
+    Check(MatchesBruteForce(GetPrimeInfos(b-3000, b+3000, threads),
+                            b-3000, b+3000),
+          "GetPrimeInfos across segments");
+    const int top = 2147483647;
+    Check(MatchesBruteForce(GetPrimeInfos(top-3000, top, threads),
+                            top-3000, top),
+          "GetPrimeInfos below 2^31");
+  }
+  Check(GetPrimeInfos(24, 28).empty() && GetPrimeInfos(10, 1).empty(),
+        "GetPrimeInfos of ranges without primes");
+}
+
+}  // namespace
+
+int main() {
+  TestGetPrimeInfos();
+  return TestResult();
+}
@@ -0,0 +1,134 @@
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+#include "roots.h"
+#include "tests/test.h"
+
+using namespace algo;
+
+namespace {
+
+std::vector<llong> PrimeFactors(llong n) {
+  std::vector<llong> res;
+  for (llong d = 2; d*d <= n; d++) {
+    if (n%d != 0) continue;
+    res.push_back(d);
+    while (n%d == 0) n /= d;
+  }
+  if (n > 1) res.push_back(n);
+  return res;
+}
+
+// Every a modulo small prime powers, against the first hit of walking the
+// powers of g. The tiny table forces several giant steps per query.
+void TestDiscreteLogSmall() {
+  bool ok = true;
+  for (auto pe : std::vector<std::pair<llong, int>>{
+           {3, 4}, {5, 2}, {7, 3}, {11, 1}, {13, 2}}) {
+    const llong p = pe.first, m = GetPower(p, pe.second);
+    for (llong g = 2; g < std::min(m, 40LL); g++) {
+      if (g%p == 0) continue;
+      DiscreteLog log(g, p, pe.second, PrimeFactors(p-1), 3);
+      std::vector<llong> first(m, -1);
+      llong x = 1;
+      for (llong i = 0; i < log.GetOrder(); i++, x = x*g%m)
+        if (first[x] < 0) first[x] = i;
+      ok = ok && x == 1;
+      for (llong a = 0; a < m; a++) ok = ok && log.Get(a) == first[a];
+    }
+  }
+  Check(ok, "DiscreteLog modulo small prime powers");
+}
+
+// Random powers of a primitive root modulo primes around 1e12, one with a
+// large prime factor in p-1, and modulo a prime cube.
+void TestDiscreteLogLarge() {
+  std::mt19937_64 rng(3);
+  for (llong p : {1000000000039LL, 999999999989LL}) {
+    const std::vector<llong> factors = PrimeFactors(p-1);
+    llong g = 2;
+    for (bool primitive = false; !primitive; ) {
+      primitive = true;
+      for (llong q : factors)
+        primitive = primitive && PowMod(g, (p-1)/q, p) != 1;
+      if (!primitive) g++;
+    }
+    DiscreteLog log(g, p, 1, factors, 1<<16);
+    std::vector<llong> xs(2000), as(2000);
+    for (int i = 0; i < 2000; i++) {
+      xs[i] = rng()%(p-1);
+      as[i] = PowMod(g, xs[i], p);
+    }
+    Check(log.Get(as, 4) == xs, "DiscreteLog modulo primes around 1e12");
+  }
+
+  const llong p = 10007, m = p*p*p;
+  DiscreteLog log(5, p, 3, PrimeFactors(p-1));
+  bool ok = true;
+  for (int i = 0; i < 1000; i++) {
+    const llong x = rng()%log.GetOrder();
+    ok = ok && log.Get(PowMod(5, x, m)) == x;
+  }
+  Check(ok, "DiscreteLog modulo 10007^3");
+}
+
+// All k-th roots of every n modulo small primes, against a table of x^k.
+void TestModularRootsSmall() {
+  bool ok = true;
+  for (llong p : {3LL, 5LL, 7LL, 13LL, 17LL, 97LL, 241LL, 257LL, 337LL}) {
+    ModularRoots roots(p, PrimeFactors(p-1), 4);
+    for (llong k = 1; k <= 40; k++) {
+      std::vector<std::vector<llong>> expected(p);
+      for (llong x = 0; x < p; x++) expected[PowMod(x, k, p)].push_back(x);
+      for (llong n = 0; n < p; n++) {
+        ok = ok && roots.AllKthRoots(n, k) == expected[n];
+        const llong x = roots.KthRoot(n, k);
+        ok = ok && (expected[n].empty() ? x == -1 : PowMod(x, k, p) == n);
+      }
+      if (k != 2) continue;
+      for (llong n = 0; n < p; n++) {
+        const llong x = roots.SquareRoot(n);
+        ok = ok && (expected[n].empty() ? x == -1 : x*x%p == n);
+      }
+    }
+  }
+  Check(ok, "ModularRoots modulo small primes");
+}
+
+// Batched square and cube roots of random residues, and of non-residues.
+void TestModularRootsLarge() {
+  std::mt19937_64 rng(7);
+  for (llong p : {998244353LL, 1000000000039LL, 999999999989LL}) {
+    ModularRoots roots(p, PrimeFactors(p-1), 1<<16);
+    for (llong k : {2LL, 3LL}) {
+      std::vector<llong> ns(5000);
+      for (llong& n : ns) n = PowMod(rng()%p, k, p);
+      const std::vector<llong> xs = k == 2 ? roots.SquareRoots(ns, 4)
+                                           : roots.KthRoots(ns, k, 4);
+      bool ok = true;
+      for (int i = 0; i < int(ns.size()); i++)
+        ok = ok && PowMod(xs[i], k, p) == ns[i];
+      Check(ok, "ModularRoots of random powers");
+    }
+
+    bool ok = true;
+    for (int i = 0; i < 100; i++) {
+      llong n = rng()%p;
+      if (PowMod(n, (p-1)/2, p) != p-1) continue;
+      ok = ok && roots.SquareRoot(n) == -1;
+    }
+    Check(ok, "ModularRoots of quadratic non-residues");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestDiscreteLogSmall();
+  TestDiscreteLogLarge();
+  TestModularRootsSmall();
+  TestModularRootsLarge();
+  return TestResult();
+}
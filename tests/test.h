@@ -0,0 +1,35 @@
+#ifndef ALGO_TESTS_TEST_H_
+#define ALGO_TESTS_TEST_H_
+
+// The harness shared by the tests in this directory. Each test is a program
+// of its own; build and run one from the repository root with
+//   g++ -std=c++17 -O2 -pthread -I. tests/<name>_test.cc && ./a.out
+// It prints PASS and exits with 0 when every check holds.
+
+#include <cstdio>
+
+namespace algo {
+
+namespace {
+
+int test_failures = 0;
+
+// Reports what failed, and keeps running the rest of the checks.
+void Check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    test_failures++;
+  }
+}
+
+// The exit code of a test program, to be returned from main.
+int TestResult() {
+  if (test_failures == 0) printf("PASS\n");
+  return test_failures == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+}  // namespace algo
+
+#endif  // ALGO_TESTS_TEST_H_